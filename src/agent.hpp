@@ -6,7 +6,16 @@
 #ifndef DAB_AGENT_HPP_
 #define DAB_AGENT_HPP_
 
+#include <sys/mman.h>
+#include <memory>
+#include <functional>
+#include <future>
+
 #include "dab.hpp"
+#include "retrograde.hpp"
+#include "nnue.hpp"
+#include "cluster.hpp"
+#include "numa.hpp"
 
 namespace DotsAndBoxes{
     
@@ -86,106 +95,442 @@ namespace DotsAndBoxes{
         }
     };
     
-    // ルート着手情報
-    std::array<RootMove, MAX_MOVES> rootBuffer;
-    int rootMoves;
+    // ルート着手情報 (探索ごとに持つ)
+    struct RootMoves{
+        std::array<RootMove, MAX_MOVES> buffer_;
+        int moves_;
+        int8_t index_[2][CELLS]; // 線 -> buffer_ 中の位置
+        uint64_t allowed_[2]; // 探索対象とする線のビット集合
+        
+        int size()const noexcept{ return moves_; }
+        RootMove& operator [](int i)noexcept{ return buffer_[i]; }
+        const RootMove& operator [](int i)const noexcept{ return buffer_[i]; }
+        RootMove* begin()noexcept{ return buffer_.data(); }
+        RootMove* end()noexcept{ return buffer_.data() + moves_; }
+        
+        template<class board_t, class dice_t>
+        void setup(const board_t& bd, dice_t& dice){
+            moves_ = genAllMoves(buffer_.data(), bd);
+            std::shuffle(begin(), end(), dice);
+            allowed_[V] = allowed_[H] = 0;
+            for(int m = 0; m < moves_; ++m){
+                allow(buffer_[m].move);
+            }
+            reindex();
+        }
+        void reindex()noexcept{
+            for(int m = 0; m < moves_; ++m){
+                const Move move = buffer_[m].move;
+                index_[move.vh][move.mz] = m;
+            }
+        }
+        void sort(int first = 0){
+            std::stable_sort(begin() + first, end());
+            reindex();
+        }
+        
+        // 探索対象の指定
+        bool allowed(Move move)const noexcept{
+            return (allowed_[move.vh] >> move.mz) & 1;
+        }
+        void allow(Move move)noexcept{
+            allowed_[move.vh] |= 1ULL << move.mz;
+        }
+        void disallow(Move move)noexcept{
+            allowed_[move.vh] &= ~(1ULL << move.mz);
+        }
+        void allowFrom(int first)noexcept{ // first 番目以降のみ探索
+            allowed_[V] = allowed_[H] = 0;
+            for(int m = first; m < moves_; ++m){
+                allow(buffer_[m].move);
+            }
+        }
+        bool restricted()const noexcept{ // 探索しない root move があるか
+            return countBits64(allowed_[V]) + countBits64(allowed_[H]) < moves_;
+        }
+        
+        RootMove& find(Move move)noexcept{
+            ASSERT(allowed(move), cerr << move << " is not a root move." << endl;);
+            return buffer_[index_[move.vh][move.mz]];
+        }
+    };
     
     // 置換表
+    // 値は手番側から見た残りのマスの得点差で保存する
+    bool isMateValue(int v)noexcept{
+        return std::abs(v) >= VALUE_MATE - SIZE;
+    }
+    // 過半数を取れる局面の値
+    // VALUE_MATE に手番側の終局時の陣地差の下界 (1 以上) を足す
+    template<class board_t>
+    Value mateValue(const board_t& bd)noexcept{
+        return Value((int)VALUE_MATE + 2 * (bd.area[bd.turnColor()] + bd.immediateReachEffect) - SIZE);
+    }
+    template<class board_t>
+    int valueToTT(Value v, const board_t& bd)noexcept{
+        return v - bd.areaDiff(bd.turnColor());
+    }
+    // 詰みの値 (VALUE_MATE + 終局時の陣地差の下界) も同様に直して保存し、
+    // 読み出した局面の陣地数では勝敗が決まらなければ普通の値の境界に戻す
+    template<class board_t>
+    Value valueFromTT(int v, const board_t& bd)noexcept{
+        const int diff = bd.areaDiff(bd.turnColor());
+        if(v >= VALUE_MATE - SIZE){
+            const int lower = v - VALUE_MATE + diff;
+            return Value(lower >= 1 ? (int)VALUE_MATE + lower : lower);
+        }
+        if(v <= -(VALUE_MATE - SIZE)){
+            const int upper = v + VALUE_MATE + diff;
+            return Value(upper <= -1 ? upper - (int)VALUE_MATE : upper);
+        }
+        return Value(v + diff);
+    }
+    
+    enum TTInsertion{
+        TT_NOT_STORED, TT_STORED_EMPTY, TT_OVERWRITTEN, TT_UPDATED
+    };
+    
+    // 保存した値が正確な値か、上界/下界か
+    enum Bound : int8_t{
+        BOUND_NONE = 0,
+        BOUND_UPPER = 1, // 値以下
+        BOUND_LOWER = 2, // 値以上
+        BOUND_EXACT = BOUND_UPPER | BOUND_LOWER
+    };
+    
+    // TT_VERIFY を定義すると各エントリに線の集合そのもの (128bit) を持たせ、
+    // キーが一致したのに局面が違う (衝突) 回数を数える。衝突したエントリは使わない
     struct HashEntry{
         Move move[2];
         uint64_t key;
-        int32_t value, depth;
+        int32_t value;
+        int16_t depth;
+        Bound bound;
+        uint8_t generation; // 置換表の世代 (0 は未使用)
+#ifdef TT_VERIFY
+        uint64_t lines[2];
+        
+        template<class board_t>
+        bool verify(const board_t& bd)const noexcept{
+            return lines[V] == uint64_t(bd.lineSet[V]) && lines[H] == uint64_t(bd.lineSet[H]);
+        }
+#endif
         
-        //void clear()noexcept{}
-        bool any()const noexcept{
-            return bool(key);
+        bool any(uint8_t ageneration)const noexcept{
+            return generation == ageneration;
         }
-        void set(uint64_t akey, Move amove,
-                 Value avalue, int adepth)noexcept{
+        template<class board_t>
+        void set(const board_t& bd, uint64_t akey, Move amove,
+                 Value avalue, int adepth, Bound abound, uint8_t ageneration)noexcept{
+#ifdef TT_VERIFY
+            lines[V] = uint64_t(bd.lineSet[V]);
+            lines[H] = uint64_t(bd.lineSet[H]);
+#endif
             key = akey;
             move[0] = amove;
             value = avalue;
             depth = adepth;
+            bound = abound;
+            generation = ageneration;
+        }
+        // alpha-beta の窓に対して値をそのまま返してよいか
+        bool cuts(int v, int adepth, Value alpha, Value beta)const noexcept{
+            return depth >= adepth
+                   && ((bound == BOUND_EXACT)
+                       || (bound == BOUND_LOWER && v >= beta)
+                       || (bound == BOUND_UPPER && v <= alpha));
         }
     };
+    // 現世代のエントリは常に先頭に詰まっている
     struct HashBucket{
         static constexpr size_t BUCKET_SIZE = 4;
         std::array<HashEntry, BUCKET_SIZE> entry_;
         
         template<class board_t>
-        HashEntry* find(const board_t& bd, uint64_t key){
+        HashEntry* find(const board_t& bd, uint64_t key, uint8_t generation, bool *const pcollided){
             for(size_t i = 0; i < BUCKET_SIZE; ++i){
-                if(!entry_[i].any()){ return nullptr; }
+                if(!entry_[i].any(generation)){ return nullptr; }
                 if(entry_[i].key == key){
+#ifdef TT_VERIFY
+                    if(!entry_[i].verify(bd)){
+                        *pcollided = true;
+                        return nullptr;
+                    }
+#endif
                     return &entry_[i];
                 }
             }
             return nullptr;
         }
         template<class board_t>
-        bool insert(const board_t& bd, uint64_t key, Move move, Value value, int depth){
+        TTInsertion insert(const board_t& bd, uint64_t key, Move move, Value value, int depth,
+                           Bound bound, uint8_t generation){
+            for(size_t i = 0; i < BUCKET_SIZE; ++i){ // 同じ局面の情報は更新する
+                if(!entry_[i].any(generation)){ break; }
+                if(entry_[i].key == key){
+                    if(depth < entry_[i].depth && bound != BOUND_EXACT){
+                        return TT_NOT_STORED;
+                    }
+                    entry_[i].set(bd, key, move, value, depth, bound, generation);
+                    return TT_UPDATED;
+                }
+            }
             for(size_t i = 0; i < BUCKET_SIZE; ++i){
-                if(!entry_[i].any()){
-                    entry_[i].set(key, move, value, depth);
-                    return true;
+                if(!entry_[i].any(generation)){
+                    entry_[i].set(bd, key, move, value, depth, bound, generation);
+                    return TT_STORED_EMPTY;
                 }
                 if(depth >= entry_[i].depth){
+                    // 末尾が埋まっていれば押し出される
+                    const bool evicted = entry_[BUCKET_SIZE - 1].any(generation);
                     for(int j = BUCKET_SIZE - 2; j >= (int)i; --j){
                         entry_[j + 1] = entry_[j];
                     }
-                    entry_[i].set(key, move, value, depth);
-                    return false;
+                    entry_[i].set(bd, key, move, value, depth, bound, generation);
+                    return evicted ? TT_OVERWRITTEN : TT_STORED_EMPTY;
                 }
             }
-            return false;
+            return TT_NOT_STORED;
         }
     };
+    // 匿名の mmap で確保するので、ゼロで埋まった状態で始まり触れたページだけが割り当てられる
+    // 消去は世代を進めるだけで済ませる
+    // 複数のスレッドで共有する場合は concurrent を指定し、バケットごとのロック (ストライプ) を取る
+    // 共有する表の消去は使っているスレッドが探索していない間に行う
     struct HashTable{
-        static constexpr size_t SIZE = (1 << 22) - 3;
+        static constexpr size_t DEFAULT_SIZE = (1 << 22) - 3;
+        static constexpr size_t LOCKS = 1024;
         
-        std::array<HashBucket, SIZE> table_;
-        size_t filled_;
+        size_t size_, bytes_;
+        HashBucket *table_;
+        std::atomic<size_t> filled_;
+        uint8_t generation_;
+        std::unique_ptr<std::atomic_flag[]> locks_; // 共有しない表では持たない
+#ifdef TT_VERIFY
+        std::atomic<int64_t> probes_, collisions_;
+#endif
         
-        HashTable(){ clear(); }
+        HashTable(size_t size = DEFAULT_SIZE, bool concurrent = false):
+        size_(size), bytes_(sizeof(HashBucket) * size), filled_(0), generation_(1){
+            void *p = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if(p == MAP_FAILED){
+                LOG_ERROR("HashTable : failed to map " << bytes_ << " bytes");
+                throw std::bad_alloc();
+            }
+            table_ = static_cast<HashBucket*>(p);
+            if(concurrent){
+                locks_.reset(new std::atomic_flag[LOCKS]);
+                for(size_t i = 0; i < LOCKS; ++i){ locks_[i].clear(); }
+            }
+#ifdef TT_VERIFY
+            probes_ = collisions_ = 0;
+#endif
+        }
+        ~HashTable(){ munmap(table_, bytes_); }
+        HashTable(const HashTable&) = delete;
+        HashTable& operator =(const HashTable&) = delete;
+        
+        size_t bytes()const noexcept{ return bytes_; }
+        // ページを NUMA ノードに均等に割り当てる (共有する表を使い始める前に呼ぶ)
+        bool interleave(const NumaTopology& topo){
+            return interleaveMemory(table_, bytes_, topo);
+        }
         
+        struct BucketLock{
+            std::atomic_flag *flag_;
+            BucketLock(std::atomic_flag *flag): flag_(flag){
+                while(flag_ != nullptr && flag_->test_and_set(std::memory_order_acquire)){
+                    std::this_thread::yield();
+                }
+            }
+            ~BucketLock(){
+                if(flag_ != nullptr){ flag_->clear(std::memory_order_release); }
+            }
+        };
+        std::atomic_flag *lockOf(size_t index)const noexcept{
+            return locks_ ? &locks_[index % LOCKS] : nullptr;
+        }
+        
+        // 見つかれば *pentry に写す (共有中に書き換えられても壊れた値を読まないように)
         template<class board_t>
-        HashEntry* find(const board_t& bd){
+        bool probe(const board_t& bd, HashEntry *const pentry){
             uint64_t key = bd.key();
-            size_t index = key % SIZE;
-            return table_[index].find(bd, key);
+            size_t index = key % size_;
+            BucketLock lock(lockOf(index));
+            bool collided = false;
+            const HashEntry *const found = table_[index].find(bd, key, generation_, &collided);
+#ifdef TT_VERIFY
+            probes_.fetch_add(1, std::memory_order_relaxed);
+            if(collided){ collisions_.fetch_add(1, std::memory_order_relaxed); }
+#endif
+            if(found == nullptr){ return false; }
+            *pentry = *found;
+            return true;
         }
         template<class board_t>
-        bool insert(const board_t& bd, Move move, Value value, int depth){
+        TTInsertion insert(const board_t& bd, Move move, Value value, int depth, Bound bound){
             uint64_t key = bd.key();
-            size_t index = key % SIZE;
-            return table_[index].insert(bd, key, move, value, depth);
+            size_t index = key % size_;
+            BucketLock lock(lockOf(index));
+            TTInsertion result = table_[index].insert(bd, key, move, value, depth, bound, generation_);
+            if(result == TT_STORED_EMPTY){ filled_.fetch_add(1, std::memory_order_relaxed); }
+            return result;
         }
         
         double filled()const{
-            return filled_ / (double)(SIZE * HashBucket::BUCKET_SIZE);
+            return filled_ / (double)(size_ * HashBucket::BUCKET_SIZE);
         }
         
         void clear(){
-            memset(table_.data(), 0, sizeof(table_));
             filled_ = 0;
+            if(++generation_ == 0){
+                // 一周したら古い世代が残らないようにページごと返す (次に触れた時にゼロから)
+                if(madvise(table_, bytes_, MADV_DONTNEED) != 0){
+                    memset(table_, 0, bytes_);
+                }
+                generation_ = 1;
+            }
+        }
+    };
+    
+    // 2段の置換表
+    // 残り深さが localDepth 未満の局面は探索スレッドごとの小さな表 (L2 キャッシュ程度) に置き、
+    // 深い局面だけを大きな表に置く。大きな表は他のスレッドと共有してよい
+    // 葉に近い大量の読み書きが共有の表のキャッシュラインを奪い合わないようにする
+    enum TTLevel{
+        TT_LOCAL, TT_MAIN
+    };
+    
+    struct TwoLevelHashTable{
+        static constexpr size_t LOCAL_SIZE = (1 << 14) - 3; // 約 1.5MB
+        
+        HashTable local_;
+        HashTable own_; // 共有の表を使わない場合の大きな表
+        HashTable *main_;
+        int localDepth_; // 0 なら全て大きな表
+        
+        TwoLevelHashTable():
+        local_(LOCAL_SIZE), main_(&own_), localDepth_(0){}
+        
+        // 共有の表を使う (nullptr なら自分の表に戻す)
+        void setShared(HashTable *shared)noexcept{
+            main_ = shared != nullptr ? shared : &own_;
+        }
+        void setLocalDepth(int depth)noexcept{
+            localDepth_ = std::max(0, depth);
+        }
+        bool shared()const noexcept{ return main_ != &own_; }
+        TTLevel level(int depth)const noexcept{
+            return depth < localDepth_ ? TT_LOCAL : TT_MAIN;
+        }
+        HashTable& table(int depth)noexcept{
+            return level(depth) == TT_LOCAL ? local_ : *main_;
+        }
+        
+        // 浅い局面は小さな表、大きな表の順に引く
+        // 大きな表の局面は深さ localDepth 以上で読んであるので、浅い問い合わせにもそのまま使える
+        // (統計の local は問い合わせの深さで数えるので、大きな表で見つかった分も含む)
+        template<class board_t>
+        bool probe(const board_t& bd, int depth, HashEntry *const pentry){
+            if(level(depth) == TT_LOCAL && local_.probe(bd, pentry)){ return true; }
+            return main_->probe(bd, pentry);
+        }
+        template<class board_t>
+        TTInsertion insert(const board_t& bd, Move move, Value value, int depth, Bound bound){
+            return table(depth).insert(bd, move, value, depth, bound);
+        }
+        double filled()const{
+            return main_->filled();
+        }
+#ifdef TT_VERIFY
+        // 両方の表での 100 万回の参照あたりの衝突回数
+        double collisionsPerMillion()const{
+            const int64_t probes = local_.probes_ + main_->probes_;
+            return probes ? (local_.collisions_ + main_->collisions_) * 1e6 / probes : 0.0;
+        }
+#endif
+        // 共有の表は消さない (持ち主が消す)
+        void clear(){
+            local_.clear();
+            if(!shared()){ own_.clear(); }
+        }
+    };
+    
+    // 履歴表 (線ごとのカット実績)
+    struct HistoryTable{
+        static constexpr int32_t MAX_SCORE = 1 << 24;
+        int32_t table_[2][CELLS];
+        
+        void clear()noexcept{
+            memset(table_, 0, sizeof(table_));
+        }
+        int32_t get(Move move)const noexcept{
+            return table_[move.vh][move.mz];
+        }
+        void update(Move move, int depth)noexcept{
+            int32_t& score = table_[move.vh][move.mz];
+            score += depth * depth;
+            if(score >= MAX_SCORE){ age(); }
+        }
+        void age()noexcept{ // 古い情報の重みを下げる
+            for(int vh = 0; vh < 2; ++vh){
+                for(int z = 0; z < CELLS; ++z){
+                    table_[vh][z] /= 2;
+                }
+            }
+        }
+    };
+    
+    // キラー手 (手数ごとに2手)
+    struct KillerTable{
+        static constexpr int N_KILLERS = 2;
+        std::array<std::array<Move, N_KILLERS>, MAX_PLY + 1> killer_;
+        
+        void clear()noexcept{
+            for(auto& k : killer_){
+                k.fill(MOVE_NONE);
+            }
+        }
+        const Move* get(int ply)const noexcept{
+            return killer_[ply].data();
+        }
+        void update(int ply, Move move)noexcept{
+            if(killer_[ply][0] != move){
+                killer_[ply][1] = killer_[ply][0];
+                killer_[ply][0] = move;
+            }
         }
     };
     
     struct MovePicker{
         Move buffer_[MAX_MOVES];
+        int32_t score_[MAX_MOVES];
         const Board& bd_;
+        const HistoryTable& history_;
+        const Move *const killer_;
         Move ttMove_;
-        int r_, m_;
+        uint64_t picked_[2]; // すでに返した手
+        int r_, k_, m_;
         int state_;
         int moves_;
         int z_;
         
-        MovePicker(const Board& bd, Move ttMove):
-        bd_(bd), ttMove_(ttMove), r_(0), m_(0), state_(0){}
+        MovePicker(const Board& bd, Move ttMove,
+                   const HistoryTable& history, const Move *killer):
+        bd_(bd), history_(history), killer_(killer), ttMove_(ttMove),
+        r_(0), k_(0), m_(0), state_(0){
+            picked_[V] = picked_[H] = 0;
+        }
+        
+        bool picked(Move move)const noexcept{
+            return (picked_[move.vh] >> move.mz) & 1;
+        }
         
 #define BEGIN_CR       switch(state_) { case 0:
 #define END_CR         state_ == __LINE__; case __LINE__:; }
 #define YIELD(move)    { state_ = __LINE__; ASSERT(bd_.valid(move), cerr << move << " is not valid.";);\
+                       picked_[(move).vh] |= 1ULL << (move).mz;\
                        return (move); case __LINE__:; }
         Move next(){
             Move move;
@@ -195,23 +540,48 @@ namespace DotsAndBoxes{
                     YIELD(ttMove_);
                 }
             }
+            // 箱を取る手
             while(r_ < bd_.numReaches){
                 z_ = bd_.reachInfo[r_].z;
                 move = fillMove(bd_.cell[z_], z_);
                 r_ += 1;
-                if(move != ttMove_){
+                if(!picked(move)){
                     YIELD(move);
                 }
             }
+            // キラー手
+            while(killer_ != nullptr && k_ < KillerTable::N_KILLERS){
+                move = killer_[k_];
+                k_ += 1;
+                if(move != MOVE_NONE && bd_.valid(move) && !picked(move)){
+                    YIELD(move);
+                }
+            }
+            // 残りは履歴表の値の順
             moves_ = genAllMoves(buffer_, bd_);
+            { // 返却済みの手を除く
+                int n = 0;
+                for(int m = 0; m < moves_; ++m){
+                    if(!picked(buffer_[m])){
+                        buffer_[n] = buffer_[m];
+                        score_[n] = history_.get(buffer_[m]);
+                        n += 1;
+                    }
+                }
+                moves_ = n;
+            }
             while(m_ < moves_){
+                { // 最大の手を前に持ってくる
+                    int best = m_;
+                    for(int m = m_ + 1; m < moves_; ++m){
+                        if(score_[m] > score_[best]){ best = m; }
+                    }
+                    std::swap(buffer_[m_], buffer_[best]);
+                    std::swap(score_[m_], score_[best]);
+                }
                 move = buffer_[m_];
                 m_ += 1;
-                if(move != ttMove_
-                   /*&& !bd_.reach(move.mz)
-                   && !bd_.reach(move.mz + dirDZ[besideLineDirection[move.vh][1]])*/){
-                    YIELD(move);
-                }
+                YIELD(move);
             }
             END_CR;
             return MOVE_NONE;
@@ -221,25 +591,252 @@ namespace DotsAndBoxes{
 #undef YIELD
     };
     
+    /**************************探索統計**************************/
+    
+    // 計測用の処理は MINIMUM (MATCH) ビルドでは消える
+#ifdef USE_ANALYZER
+#define ANALYZE(...) { __VA_ARGS__; }
+#else
+#define ANALYZE(...)
+#endif
+    
+    struct SearchStats{
+        struct Iteration{
+            int depth;
+            int64_t time, nodes; // 反復終了時点の累計
+        };
+        std::array<int64_t, MAX_PLY + 1> nodesByPly; // ルートからの手数ごと
+        std::array<int64_t, MAX_MOVES> cutoffsByIndex; // 何手目でカットしたか
+        int64_t ttProbes, ttHits, ttStores, ttOverwrites;
+        int64_t ttLocalProbes, ttLocalHits; // 2段の置換表の小さい方
+        int64_t reductions, researches, prunes;
+        std::vector<Iteration> iterations;
+        
+        void clear(){
+            nodesByPly.fill(0);
+            cutoffsByIndex.fill(0);
+            ttProbes = ttHits = ttStores = ttOverwrites = 0;
+            ttLocalProbes = ttLocalHits = 0;
+            reductions = researches = prunes = 0;
+            iterations.clear();
+        }
+        void addNode(int ply)noexcept{ nodesByPly[ply] += 1; }
+        void addProbe(TTLevel level, bool hit)noexcept{
+            ttProbes += 1;
+            if(hit){ ttHits += 1; }
+            if(level == TT_LOCAL){
+                ttLocalProbes += 1;
+                if(hit){ ttLocalHits += 1; }
+            }
+        }
+        double ttHitRate(TTLevel level)const{
+            const int64_t probes = level == TT_LOCAL ? ttLocalProbes : ttProbes - ttLocalProbes;
+            const int64_t hits = level == TT_LOCAL ? ttLocalHits : ttHits - ttLocalHits;
+            return probes ? hits / (double)probes : 0.0;
+        }
+        void addStore(TTInsertion result)noexcept{
+            if(result != TT_NOT_STORED){ ttStores += 1; }
+            if(result == TT_OVERWRITTEN){ ttOverwrites += 1; }
+        }
+        void addCutoff(int index)noexcept{ cutoffsByIndex[index] += 1; }
+        void addReduction()noexcept{ reductions += 1; }
+        void addResearch()noexcept{ researches += 1; }
+        void addPrune()noexcept{ prunes += 1; }
+        void addIteration(int depth, int64_t time, int64_t nodes){
+            iterations.push_back({depth, time, nodes});
+        }
+        
+        int64_t cutoffs()const{
+            return std::accumulate(cutoffsByIndex.begin(), cutoffsByIndex.end(), int64_t(0));
+        }
+        double firstMoveCutoffRate()const{
+            int64_t all = cutoffs();
+            return all ? cutoffsByIndex[0] / (double)all : 0.0;
+        }
+        double branchingFactor(int i)const{ // i 回目の反復の前回に対するノード数の比
+            if(i <= 0){ return 0; }
+            int64_t prev = iterations[i - 1].nodes;
+            int64_t cur = iterations[i].nodes - prev;
+            int64_t prevOnly = prev - (i >= 2 ? iterations[i - 2].nodes : 0);
+            return prevOnly ? cur / (double)prevOnly : 0.0;
+        }
+        
+        std::string toJSON()const{
+            std::ostringstream oss;
+            auto array = [&oss](const int64_t *a, int n){
+                while(n > 0 && a[n - 1] == 0){ --n; } // 末尾の0は省略
+                oss << "[";
+                for(int i = 0; i < n; ++i){
+                    oss << (i ? "," : "") << a[i];
+                }
+                oss << "]";
+            };
+            oss << "{\"nodes_by_ply\":";
+            array(nodesByPly.data(), nodesByPly.size());
+            oss << ",\"tt\":{\"probes\":" << ttProbes << ",\"hits\":" << ttHits;
+            oss << ",\"stores\":" << ttStores << ",\"overwrites\":" << ttOverwrites;
+            oss << ",\"local_probes\":" << ttLocalProbes << ",\"local_hits\":" << ttLocalHits << "}";
+            oss << ",\"cutoffs_by_index\":";
+            array(cutoffsByIndex.data(), cutoffsByIndex.size());
+            oss << ",\"reductions\":" << reductions << ",\"researches\":" << researches;
+            oss << ",\"prunes\":" << prunes;
+            oss << ",\"iterations\":[";
+            for(int i = 0; i < (int)iterations.size(); ++i){
+                const Iteration& it = iterations[i];
+                oss << (i ? "," : "") << "{\"depth\":" << it.depth << ",\"time_us\":" << it.time;
+                oss << ",\"nodes\":" << it.nodes << ",\"branching\":" << branchingFactor(i) << "}";
+            }
+            oss << "]}";
+            return oss.str();
+        }
+    };
+    
+    /**************************勝敗の証明**************************/
+    
+    enum SolveResult{
+        SOLVE_UNKNOWN = -2, // 時間切れ
+        SOLVE_LOSS = -1, SOLVE_DRAW = 0, SOLVE_WIN = 1
+    };
+    
+    std::ostream& operator <<(std::ostream& ost, SolveResult result){
+        const char *str[] = {"unknown", "loss", "draw", "win"};
+        ost << str[result + 2];
+        return ost;
+    }
+    
+    // 反復ごとに通知する内容
+    struct SearchInfo{
+        int depth;
+        Move move;
+        Value value;
+        int64_t time; // ms
+        int64_t nodes;
+    };
+    
     struct SearchAgent{
-        HashTable tt;
+        TwoLevelHashTable tt;
+        RootMoves rootMoves;
+        std::mt19937 dice; // 他の探索と共有しない乱数
+        HistoryTable history; // 探索スレッドごとに持つ
+        KillerTable killers;
         int64_t hashCut;
         int64_t nodes;
         ClockMicS clock;
-        int64_t timeLimit;
+        std::atomic<int64_t> timeLimit; // 探索開始からの持ち時間 (探索中に他のスレッドから変えてよい)
+        int64_t nodeLimit; // 探索ノード数の上限 (再現性のある探索量にしたい場合)
+        std::atomic<bool> stopRequest; // 他のスレッドからの中断要求 (探索中に見る)
+        std::function<void(const SearchInfo&)> infoCallback; // 探索スレッドから反復ごとに呼ぶ
+        std::thread searchThread; // startSearch() の探索
+        bool verbose; // 探索の経過を出力するか
+        LogRateLimiter infoLimiter; // 反復ごとの出力の間隔
+        bool mateCut; // 過半数を取れる局面を勝ちとして打ち切るか
+        bool selective; // 後半の手や箱を渡す手を浅く読むか (dab_test -L で比較)
+        int multiPV; // 正確な評価値を求める上位の手の数
+        int rootPly;
+        const SolutionTable *solution; // 後退解析の結果
+        Cluster *cluster; // root move を分けて探索させる他のプロセス
+#ifdef USE_ANALYZER
+        SearchStats stats;
+        std::ostream *statsStream; // 探索ごとに JSON を1行出力する先
+#endif
         
         void initSearch(){
             clock.start();
             nodes = 0;
             hashCut = 0;
+            ANALYZE(stats.clear());
+            history.age();
+            killers.clear();
         }
         void initialize(){
             tt.clear();
+            history.clear();
+            killers.clear();
         }
         
-        SearchAgent(int tl){
+        SearchAgent(int tl):
+        dice(DotsAndBoxes::dice()), nodeLimit(std::numeric_limits<int64_t>::max()),
+        verbose(true), infoLimiter(100), mateCut(true), selective(false), multiPV(1),
+        solution(nullptr), cluster(nullptr){
             timeLimit = tl * 1000;
+            stopRequest = false;
+            ANALYZE(statsStream = nullptr);
+        }
+        ~SearchAgent(){
+            stopSearch();
+        }
+        void setMultiPV(int k){
+            multiPV = std::max(1, std::min(k, MAX_MOVES));
+        }
+        void setSolution(const SolutionTable *table){
+            solution = table;
+        }
+        void setCluster(Cluster *acluster){
+            cluster = acluster;
+        }
+        void setNodeLimit(int64_t limit){
+            nodeLimit = limit;
+        }
+        void setSelective(bool s){
+            selective = s;
+        }
+        // 深い局面の置換表を他の探索と共有する
+        void setSharedTable(HashTable *shared){
+            tt.setShared(shared);
+        }
+        // この残り深さ未満の局面は自分だけの小さな表に置く
+        void setLocalDepth(int depth){
+            tt.setLocalDepth(depth);
+        }
+        void setTimeLimit(int64_t ms){
+            timeLimit.store(ms * 1000, std::memory_order_relaxed);
+        }
+        void setInfoCallback(std::function<void(const SearchInfo&)> callback){
+            infoCallback = std::move(callback);
+        }
+        bool stopped()const{
+            return stopRequest.load(std::memory_order_relaxed)
+                   || clock.stop() >= timeLimit.load(std::memory_order_relaxed) || nodes >= nodeLimit;
+        }
+        
+        // 非同期の探索
+        // 探索中に他のスレッドから呼んでよいのは requestStop() と setTimeLimit() のみ
+        // 中断した場合は最後に完了した反復の結果を返す
+        template<class oboard_t>
+        std::future<std::tuple<Move, Value>> startSearch(const oboard_t& obd, int depth){
+            waitSearch();
+            stopRequest = false;
+            const Board bd = obd;
+            std::packaged_task<std::tuple<Move, Value>()> task([this, bd, depth](){
+                auto result = searchMove(bd, depth);
+                stopRequest = false;
+                return result;
+            });
+            auto future = task.get_future();
+            searchThread = std::thread(std::move(task));
+            return future;
+        }
+        void requestStop()noexcept{
+            stopRequest.store(true, std::memory_order_relaxed);
+        }
+        // 探索スレッドの終了を待つ
+        void waitSearch(){
+            if(searchThread.joinable()){ searchThread.join(); }
         }
+        // 打ち切って終了を待つ
+        void stopSearch(){
+            if(searchThread.joinable()){
+                requestStop();
+                searchThread.join();
+            }
+        }
+        
+        // 選択的探索
+        // 何手目以降を浅くするか、何手以上残っていれば浅くするか
+        static constexpr int LMR_MOVES = 3;
+        static constexpr int LMR_DEPTH = 3;
+        // 安全な手がある局面で、箱を渡す手を読まない深さ
+        static constexpr int SACRIFICE_PRUNE_DEPTH = 2;
         
         template<bool PV, bool ROOT, class board_t>
         std::tuple<Move, Value> search(board_t& bd, int depth,
@@ -248,78 +845,132 @@ namespace DotsAndBoxes{
             Move ttMove = MOVE_NONE;
             Value ttValue;
             
-            if(!ROOT && !PV){
-                const HashEntry *const pentry = tt.find(bd);
-                if(pentry != nullptr){
+            { // ルートと PV では手の順序にのみ使い、値では打ち切らない
+                HashEntry entry;
+                const bool found = tt.probe(bd, depth, &entry);
+                ANALYZE(stats.addProbe(tt.level(depth), found));
+                if(found){
                     hashCut += 1;
-                    ttValue = Value(pentry->value);
-                    if(pentry->depth >= depth){
-                        return std::make_tuple(pentry->move[0], ttValue);
+                    ttMove = entry.move[0];
+                    ttValue = valueFromTT(entry.value, bd);
+                    if(!ROOT && !PV && entry.cuts(ttValue, depth, alpha, beta)){
+                        return std::make_tuple(entry.move[0], ttValue);
                     }
                 }
             }
-            if(!ROOT && bd.mate()){
-                return std::make_tuple(MOVE_NONE, Value((int)VALUE_MATE + bd.areaDiff(turnColor) \
-                                                        + bd.immediateReachEffect));
-            }
-            if(depth <= 0 && bd.numReaches <= 0){
+            if(bd.filled()){
                 return std::make_tuple(MOVE_NONE, Value(bd.areaDiff(turnColor)));
             }
+            if(!ROOT && mateCut && bd.mate()){
+                return std::make_tuple(MOVE_NONE, mateValue(bd));
+            }
+            if(depth <= 0){
+                return std::make_tuple(MOVE_NONE, qsearch(bd, alpha, beta));
+            }
             //std::array<Move, MAX_MOVES> buffer;
             //const int moves = genAllMoves(buffer.data(), bd);
+            const Value alphaOrig = alpha;
             Value bestValue = -VALUE_INFINITE;
             Move bestMove = MOVE_NONE;
             int moveCount = 0;
             Move move;
             
-            MovePicker mp(bd, ttMove);
+            const Move *const killer = killers.get(bd.ply);
+            MovePicker mp(bd, ttMove, history, killer);
+            bool safeSearched = false; // 箱を渡さない手を既に読んだ (安全な手が存在する)
             
             while(bestValue < std::min(beta, VALUE_MATE) && (move = mp.next()) != MOVE_NONE){
                 //Move move = buffer[m];
                 // ルートの候補手として指定されていないものは探索しない
-                if(ROOT && !std::count(rootBuffer.cbegin(), rootBuffer.cbegin() + rootMoves, move)){
+                if(ROOT && !rootMoves.allowed(move)){
                     continue;
                 }
                 Value value;
+                const int64_t nodesBefore = nodes;
                 int newArea = bd.move(move); nodes += 1;
+                ANALYZE(stats.addNode(bd.ply - rootPly));
                 //cerr << bd.areaDiff(turnColor) << endl;
-                if(moveCount == 0){ // pv
-                    if(newArea){ // same
-                        auto result = search<PV, false>(bd, depth, alpha, beta);
-                        value = std::get<1>(result);
-                    }else{ // opponent
-                        auto result = search<PV, false>(bd, depth - 1, -beta, -alpha);
-                        value = -std::get<1>(result);
+                // 取らずに相手が取れる箱を残す手
+                const bool sacrifice = !newArea && bd.numReaches > 0;
+                int reduction = 0;
+                // 詰みの値が絡む窓では正確に読む
+                if(selective && !newArea && moveCount > 0
+                   && !isMateValue(alpha) && !isMateValue(beta)){
+                    if(sacrifice && safeSearched){
+                        if(!PV && depth <= SACRIFICE_PRUNE_DEPTH){ // 読まない
+                            bd.unmove(move);
+                            ANALYZE(stats.addPrune());
+                            continue;
+                        }
+                        reduction += 1;
+                    }
+                    if(depth >= LMR_DEPTH && moveCount >= LMR_MOVES
+                       && move != ttMove && move != killer[0] && move != killer[1]){
+                        reduction += 1;
+                    }
+                }
+                if(reduction > 0){
+                    // 浅く幅0の窓で読み、alpha を越えたら元の深さで読み直す
+                    ANALYZE(stats.addReduction());
+                    auto result = search<false, false>(bd, depth - 1 - reduction,
+                                                       Value(-(int)alpha - 1), -alpha);
+                    const Value reduced = std::get<1>(result);
+                    value = reduced == VALUE_NONE ? VALUE_NONE : -reduced;
+                    if(value != VALUE_NONE && value > alpha){
+                        ANALYZE(stats.addResearch());
+                        reduction = 0;
                     }
-                }else{
-                    if(newArea){ // same
-                        auto result = search<false, false>(bd, depth, alpha, beta);
-                        value = std::get<1>(result);
-                    }else{ // opponent
-                        auto result = search<false, false>(bd, depth - 1, -beta, -alpha);
-                        value = -std::get<1>(result);
+                }
+                if(reduction == 0){
+                    if(moveCount == 0){ // pv
+                        if(newArea){ // same
+                            auto result = search<PV, false>(bd, depth, alpha, beta);
+                            value = std::get<1>(result);
+                        }else{ // opponent
+                            auto result = search<PV, false>(bd, depth - 1, -beta, -alpha);
+                            value = -std::get<1>(result);
+                        }
+                    }else{
+                        if(newArea){ // same
+                            auto result = search<false, false>(bd, depth, alpha, beta);
+                            value = std::get<1>(result);
+                        }else{ // opponent
+                            auto result = search<false, false>(bd, depth - 1, -beta, -alpha);
+                            value = -std::get<1>(result);
+                        }
                     }
                 }
                 bd.unmove(move);
                 
                 // 時間チェック
-                if(value == VALUE_NONE || clock.stop() >= timeLimit){
+                if(value == VALUE_NONE || stopped()){
                     return std::make_tuple(MOVE_NONE, VALUE_NONE);
                 }
+                if(!newArea && !sacrifice){
+                    safeSearched = true;
+                }
                 
                 if(ROOT){
                     // root move に結果を保存
-                    RootMove& rm = *std::find(rootBuffer.begin(), rootBuffer.begin() + rootMoves, move);
+                    RootMove& rm = rootMoves.find(move);
                     //cerr << move << " " << value;
+                    rm.nodes += nodes - nodesBefore;
                     if(moveCount == 0 || value > alpha){
                         rm.value = value;
+                        rm.searchDepth = depth;
                     }else{
                         rm.value = -VALUE_INFINITE;
                     }
                 }
                 if(value > bestValue){
-                    if(!ROOT && value > beta){
-                        tt.insert(bd, move, value, depth);
+                    if(!ROOT && value >= beta){
+                        // カットした手を記録
+                        ANALYZE(stats.addCutoff(moveCount));
+                        if(!newArea){
+                            killers.update(bd.ply, move);
+                            history.update(move, depth);
+                        }
+                        store(bd, move, value, depth, BOUND_LOWER);
                         return std::make_tuple(move, value);
                     }
                     bestValue = value;
@@ -329,9 +980,70 @@ namespace DotsAndBoxes{
                 moveCount += 1;
             }
             ASSERT(bestValue > -VALUE_INFINITE, cerr << bestValue << endl;);
-            tt.insert(bd, bestMove, bestValue, depth);
+            if(ROOT && rootMoves.restricted()){
+                // 一部の手のみの最善値なので、この局面の値としては下界にしかならない
+                if(bestValue > alphaOrig){
+                    store(bd, bestMove, bestValue, depth, BOUND_LOWER);
+                }
+                return std::make_tuple(bestMove, bestValue);
+            }
+            store(bd, bestMove, bestValue, depth,
+                  bestValue >= beta ? BOUND_LOWER : (bestValue > alphaOrig ? BOUND_EXACT : BOUND_UPPER));
             return std::make_tuple(bestMove, bestValue);
         }
+        // 置換表のキーは陣地数を含まないので、陣地数に依存する値は境界としてのみ保存する
+        // 詰みの値は勝ちなら陣地差の下界、負けなら上界の意味しか持たない
+        // 過半数の判定 (陣地数に依存) で打ち切った値が混ざりうるので、正確な値も下界として保存する
+        template<class board_t>
+        void store(const board_t& bd, Move move, Value value, int depth, Bound bound){
+            if(isMateValue(value)){
+                const Bound side = value > 0 ? BOUND_LOWER : BOUND_UPPER;
+                if(!(bound & side)){ return; } // 逆側の境界は陣地差では表せない
+                bound = side;
+            }else if(mateCut && bound == BOUND_EXACT){
+                bound = BOUND_LOWER;
+            }
+            TTInsertion stored = tt.insert(bd, move, Value(valueToTT(value, bd)), depth, bound);
+            ANALYZE(stats.addStore(stored));
+        }
+        
+        // 静止探索 : 箱を取る手と double-dealing のみを読む
+        template<class board_t>
+        Value qsearch(board_t& bd, Value alpha, Value beta){
+            Color turnColor = bd.turnColor();
+            if(mateCut && bd.mate()){
+                return mateValue(bd);
+            }
+            // ここで止めた場合の評価 (stand pat)
+            Value bestValue = Value(evaluate(bd));
+            if(bd.numReaches <= 0 || bestValue >= beta){
+                return bestValue;
+            }
+            alpha = std::max(alpha, bestValue);
+            
+            std::array<Move, MAX_MOVES> buffer;
+            const int moves = genQuiescenceMoves(buffer.data(), bd);
+            for(int m = 0; m < moves; ++m){
+                Move move = buffer[m];
+                Value value;
+                int newArea = bd.move(move); nodes += 1;
+                ANALYZE(stats.addNode(bd.ply - rootPly));
+                if(newArea){ // same
+                    value = qsearch(bd, alpha, beta);
+                }else{ // opponent
+                    value = -qsearch(bd, -beta, -alpha);
+                }
+                bd.unmove(move);
+                
+                if(value > bestValue){
+                    bestValue = value;
+                    if(value >= beta){ break; }
+                    alpha = std::max(alpha, value);
+                }
+            }
+            return bestValue;
+        }
+        
         template<class oboard_t>
         std::tuple<Move, Value> searchMove(const oboard_t& obd, int depth){
             if(obd.ply == 0){
@@ -339,35 +1051,164 @@ namespace DotsAndBoxes{
             }
             initSearch();
             Board bd = obd;
+            rootPly = bd.ply;
             //cerr << bd;
             // root move の用意
-            rootMoves = genAllMoves(rootBuffer.data(), bd);
-            std::shuffle(rootBuffer.begin(), rootBuffer.begin() + rootMoves, dice);
+            rootMoves.setup(bd, dice);
             
-            MovePicker mp(bd, MOVE_NONE);
-            Move move;
-            while((move = mp.next()) != MOVE_NONE){
-                cerr << move << " ";
+            // 解の表があれば探索しない
+            if(solution != nullptr && solution->matches(LENGTH_X, LENGTH_Y)){
+                auto result = solvedMove(*solution, bd, rootMoves);
+                rootMoves.sort();
+                if(verbose){
+                    LOG_INFO("solved move " << std::get<0>(result) << " value " << std::get<1>(result));
+                }
+                return result;
             }
             
-            Move bestMove;
-            Value bestValue;
-            for(int iteration = 1; iteration <= depth && clock.stop() < timeLimit; ++iteration){
-                auto result = search<true, true>(bd, iteration, -VALUE_INFINITE, VALUE_INFINITE);
+            // 他のプロセスに root move を分けて探索させる
+            // 全てのワーカーと切れた場合はここで探索する
+            if(cluster != nullptr && cluster->searchRoot(bd, rootMoves, depth, timeLimit / 1000, &nodes)){
+                rootMoves.sort();
+                if(verbose){
+                    LOG_INFO("cluster move " << rootMoves[0].move << " value " << rootMoves[0].value
+                             << " time " << clock.stop() / 1000 << " nodes " << nodes);
+                }
+                return std::make_tuple(rootMoves[0].move, rootMoves[0].value);
+            }
+            
+            if(LOG_ENABLED(LOG_LEVEL_DEBUG) && verbose){
+                std::ostringstream oss;
+                MovePicker mp(bd, MOVE_NONE, history, nullptr);
+                Move move;
+                while((move = mp.next()) != MOVE_NONE){
+                    oss << move << " ";
+                }
+                LOG_DEBUG("move order " << oss.str());
+            }
+            infoLimiter.reset();
+            
+            // 最初の反復の前に止められても合法手を返す
+            Move bestMove = rootMoves[0].move;
+            Value bestValue = rootMoves[0].value;
+            const int numPV = std::min(multiPV, rootMoves.size());
+            int logged = 0, completed = 0;
+            for(int iteration = 1; iteration <= depth && !stopped(); ++iteration){
+                // 上位の手から順に、それまでの PV の手を除いて全幅で探索
+                // 置換表は共有するので2本目以降は安く済む
+                int pv = 0;
+                for(; pv < numPV && !stopped(); ++pv){
+                    rootMoves.allowFrom(pv);
+                    auto result = search<true, true>(bd, iteration, -VALUE_INFINITE, VALUE_INFINITE);
+                    if(std::get<1>(result) == VALUE_NONE){ break; }
+                    rootMoves.sort(pv);
+                }
+                rootMoves.allowFrom(0);
+                // 中断した反復の値は一部の手しか読んでいないので使わない
+                if(pv < numPV){ break; }
+                completed = iteration;
                 // root move の並べ替え
-                std::stable_sort(rootBuffer.begin(), rootBuffer.begin() + rootMoves);
+                rootMoves.sort();
                 // previous value を保存
-                for(int m = 0; m < rootMoves; ++m){
-                    rootBuffer[m].previousValue = rootBuffer[m].value;
+                for(RootMove& rm : rootMoves){
+                    rm.previousValue = rm.value;
                 }
-                bestMove = rootBuffer[0].move;
-                bestValue = rootBuffer[0].value;
-                cerr << "iteration " << iteration << " move " << bestMove << " value " << bestValue;
-                cerr << " time " << clock.stop() / 1000 << " nodes " << nodes;
-                cerr << " hashcut " << hashCut << " hashfull " << tt.filled() << endl;
+                bestMove = rootMoves[0].move;
+                bestValue = rootMoves[0].value;
+                ANALYZE(stats.addIteration(iteration, clock.stop(), nodes));
+                if(infoCallback){
+                    infoCallback(SearchInfo{iteration, bestMove, bestValue, clock.stop() / 1000, nodes});
+                }
+                // 浅い反復は一瞬で終わるので間引く (最後の反復は必ず出す)
+                const bool last = iteration == depth || stopped();
+                if(!LOG_ENABLED(LOG_LEVEL_INFO) || !verbose || !(infoLimiter.allow() || last)){ continue; }
+                logIteration(iteration, bestMove, bestValue, numPV);
+                logged = iteration;
+            }
+            // 次の反復の途中で止まった場合も、返す結果の反復は出す
+            // (root move の値は中断した反復で書き換わっているので最善手のみ)
+            if(completed > logged && LOG_ENABLED(LOG_LEVEL_INFO) && verbose){
+                logIteration(completed, bestMove, bestValue, 1);
             }
+            ANALYZE(if(statsStream != nullptr){ *statsStream << stats.toJSON() << endl; });
             return std::make_tuple(bestMove, bestValue);
         }
+        
+        void logIteration(int iteration, Move bestMove, Value bestValue, int numPV){
+            std::ostringstream oss;
+            oss << "iteration " << iteration << " move " << bestMove << " value " << bestValue;
+            oss << " time " << clock.stop() / 1000 << " nodes " << nodes;
+            oss << " hashcut " << hashCut << " hashfull " << tt.filled();
+            ANALYZE(oss << " firstcut " << stats.firstMoveCutoffRate());
+#ifdef TT_VERIFY
+            oss << " collisions/Mprobe " << tt.collisionsPerMillion();
+#endif
+            ANALYZE(if(tt.localDepth_ > 0){
+                oss << " tthit local " << stats.ttHitRate(TT_LOCAL) << " main " << stats.ttHitRate(TT_MAIN);
+            });
+            if(numPV > 1){
+                for(int pv = 0; pv < numPV; ++pv){
+                    const RootMove& rm = rootMoves[pv];
+                    oss << endl << " pv " << (pv + 1) << " move " << rm.move << " value " << rm.value;
+                    oss << " depth " << rm.searchDepth << " nodes " << rm.nodes;
+                }
+            }
+            LOG_INFO(oss.str());
+        }
+        
+        // 証明の間だけ探索の設定を変え、抜ける時に (例外でも) 元に戻す
+        struct ProofSettings{
+            SearchAgent& agent;
+            const bool mateCut, selective;
+            HashTable *const main;
+            
+            ProofSettings(SearchAgent& a, bool amateCut):
+            agent(a), mateCut(a.mateCut), selective(a.selective), main(a.tt.main_){
+                agent.mateCut = amateCut;
+                agent.selective = false; // 証明なので全ての手を読む
+                // 通常の探索が枝刈りや静的評価で付けた値を証明に使わないよう、自分の表を空にして使う
+                agent.tt.setShared(nullptr);
+                agent.tt.clear();
+            }
+            ~ProofSettings(){
+                agent.mateCut = mateCut;
+                agent.selective = selective;
+                agent.tt.setShared(main != &agent.tt.own_ ? main : nullptr);
+            }
+        };
+        
+        // 手番側の終局時の陣地差が k 以上かを幅0の窓で調べる
+        // 戻り値 1 : k 以上 (*pmove にその手), 0 : k 未満, -1 : 時間切れ
+        template<class oboard_t>
+        int proveAtLeast(const oboard_t& obd, int k, Move *const pmove = nullptr){
+            initSearch();
+            Board bd = obd;
+            rootPly = bd.ply;
+            rootMoves.setup(bd, dice);
+            // 過半数を取ったことは差が 1 (偶数マスなら 2) 以上であることしか示さない
+            ProofSettings settings(*this, k == 0 || k == 1);
+            // 深さを残りの線の数にすれば静止探索に入らず終局まで読み切る
+            auto result = search<false, true>(bd, MAX_PLY - bd.ply, Value(k - 1), Value(k));
+            const Value value = std::get<1>(result);
+            if(value == VALUE_NONE){ return -1; }
+            if(verbose){
+                LOG_INFO("prove >= " << k << " : " << (value >= k) << " value " << value
+                         << " time " << clock.stop() / 1000 << " nodes " << nodes);
+            }
+            if(value >= k && pmove != nullptr){ *pmove = std::get<0>(result); }
+            return value >= k ? 1 : 0;
+        }
+        
+        template<class oboard_t>
+        SolveResult solve(const oboard_t& obd, Move *const pmove = nullptr){
+            int win = proveAtLeast(obd, 1, pmove);
+            if(win < 0){ return SOLVE_UNKNOWN; }
+            if(win > 0){ return SOLVE_WIN; }
+            if(SIZE % 2 == 1){ return SOLVE_LOSS; } // 引き分けは無い
+            int draw = proveAtLeast(obd, 0, pmove);
+            if(draw < 0){ return SOLVE_UNKNOWN; }
+            return draw > 0 ? SOLVE_DRAW : SOLVE_LOSS;
+        }
     };
 }
 
@@ -0,0 +1,304 @@
+/*
+ cluster.hpp
+ Katsuki Ohto
+ */
+
+#ifndef DAB_CLUSTER_HPP_
+#define DAB_CLUSTER_HPP_
+
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <deque>
+
+#include "dab.hpp"
+
+namespace DotsAndBoxes{
+    
+    /**************************通信**************************/
+    
+    // 1行1メッセージで送受信する
+    struct MessageSocket{
+        int fd_;
+        std::string buffer_; // 受信済みで未処理の分
+        
+        MessageSocket(int fd = -1): fd_(fd){}
+        
+        bool valid()const noexcept{ return fd_ >= 0; }
+        bool send(const std::string& message){
+            const std::string line = message + "\n";
+            size_t sent = 0;
+            while(sent < line.size()){
+                ssize_t n = ::send(fd_, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+                if(n <= 0){ return false; }
+                sent += n;
+            }
+            return true;
+        }
+        // 届いている分を読む (切断されていれば false)
+        bool receive(){
+            char buf[4096];
+            ssize_t n = ::recv(fd_, buf, sizeof(buf), 0);
+            if(n <= 0){ return false; }
+            buffer_.append(buf, n);
+            return true;
+        }
+        // 1行揃っていれば取り出す
+        bool pop(std::string *const pline){
+            size_t pos = buffer_.find('\n');
+            if(pos == std::string::npos){ return false; }
+            *pline = buffer_.substr(0, pos);
+            buffer_.erase(0, pos + 1);
+            return true;
+        }
+        // 1行揃うまで待つ
+        bool receiveLine(std::string *const pline){
+            while(!pop(pline)){
+                if(!receive()){ return false; }
+            }
+            return true;
+        }
+        void close(){
+            if(fd_ >= 0){ ::close(fd_); }
+            fd_ = -1;
+            buffer_.clear();
+        }
+    };
+    
+    int connectSocket(const std::string& host, int port){
+        addrinfo hints, *res;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0){
+            return -1;
+        }
+        int fd = -1;
+        for(addrinfo *p = res; p != nullptr; p = p->ai_next){
+            fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+            if(fd < 0){ continue; }
+            if(connect(fd, p->ai_addr, p->ai_addrlen) == 0){ break; }
+            ::close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        if(fd >= 0){
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        return fd;
+    }
+    
+    int listenSocket(int port){
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0){ return -1; }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, 4) < 0){
+            ::close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    
+    /**************************局面の受け渡し**************************/
+    
+    // "ply turn area[B] area[W] 縦線の集合 横線の集合" (線の集合は16進)
+    std::string encodePosition(const MiniBoard& bd){
+        std::ostringstream oss;
+        oss << bd.ply << " " << bd.turn << " " << bd.area[B] << " " << bd.area[W];
+        oss << std::hex << " " << uint64_t(bd.lineSet[V]) << " " << uint64_t(bd.lineSet[H]);
+        return oss.str();
+    }
+    
+    bool decodePosition(std::istream& is, MiniBoard *const pbd){
+        int ply, turn, area[2];
+        uint64_t lines[2];
+        is >> ply >> turn >> area[B] >> area[W] >> std::hex >> lines[V] >> lines[H] >> std::dec;
+        if(!is){ return false; }
+        pbd->clear();
+        for(VH vh = VH(0); (int)vh < 2; ++vh){
+            if(lines[vh] & ~validLineMask[vh]){ return false; }
+            for(uint64_t rest = lines[vh]; rest; rest &= rest - 1){
+                pbd->move(Move(vh, bsf64(rest)));
+            }
+        }
+        if(pbd->ply != ply){ return false; }
+        // 手番と陣地は線を引いた順序によるので送られた値を使う
+        pbd->turn = turn;
+        pbd->area[B] = area[B];
+        pbd->area[W] = area[W];
+        return true;
+    }
+    
+    /**************************root move の分配**************************/
+    
+    // 渡した時間を過ぎてもここまでは結果を待つ (通信と探索の打ち切りの遅れの分)
+    constexpr int64_t CLUSTER_MARGIN_MS = 1000;
+    
+    // 各ワーカーに root move を1つずつ渡し、終わったところから次を渡す
+    // ワーカーは自分の置換表で「その手を指した後の局面」を探索して値を返す
+    // 協定 : 親 -> "unit id depth 時間(ms) 手 局面", ワーカー -> "result id 値 ノード数 深さ"
+    struct Cluster{
+        struct Worker{
+            std::string host;
+            int port;
+            MessageSocket socket;
+            int unit; // 担当中の番号 (-1 なら空き)
+            int64_t deadline; // 担当の結果を待つ期限 (searchRoot 開始からの ms)
+        };
+        std::vector<Worker> workers_;
+        
+        ~Cluster(){ close(); }
+        
+        // "host:port,host:port,..." に接続する
+        int connect(const std::string& spec){
+            std::istringstream iss(spec);
+            std::string token;
+            while(std::getline(iss, token, ',')){
+                const size_t colon = token.rfind(':');
+                if(colon == std::string::npos){
+                    LOG_WARN("Cluster::connect() : invalid worker " << token);
+                    continue;
+                }
+                Worker w;
+                w.host = token.substr(0, colon);
+                w.port = atoi(token.substr(colon + 1).c_str());
+                w.socket = MessageSocket(connectSocket(w.host, w.port));
+                w.unit = -1;
+                w.deadline = 0;
+                if(!w.socket.valid()){
+                    LOG_WARN("Cluster::connect() : failed to connect " << token);
+                    continue;
+                }
+                workers_.push_back(w);
+            }
+            LOG_INFO("Cluster : " << alive() << " workers");
+            return alive();
+        }
+        void close(){
+            for(Worker& w : workers_){
+                if(w.socket.valid()){ w.socket.send("quit"); }
+                w.socket.close();
+            }
+        }
+        int alive()const noexcept{
+            int n = 0;
+            for(const Worker& w : workers_){ n += w.socket.valid(); }
+            return n;
+        }
+        
+        // 全ての root move の値が揃えば true
+        // 制限時間を過ぎた場合は揃った分だけで true (揃わなかった手は -VALUE_INFINITE)
+        // 1つも揃わずに全てのワーカーと切れるか、制限時間を過ぎた場合は false
+        // 期限までに結果を返さないワーカーは切れたものとして扱う
+        template<class board_t, class rootMoves_t>
+        bool searchRoot(const board_t& bd, rootMoves_t& rootMoves, int depth,
+                        int64_t timeLimitMs, int64_t *const pnodes){
+            const int units = rootMoves.size();
+            if(alive() == 0){ return false; }
+            const std::string position = encodePosition(MiniBoard(bd));
+            ClockMicS clock;
+            clock.start();
+            std::deque<int> queue;
+            for(int i = 0; i < units; ++i){ queue.push_back(i); }
+            std::vector<bool> finished(units, false);
+            int done = 0;
+            const int64_t limit = timeLimitMs + CLUSTER_MARGIN_MS;
+            
+            auto lost = [&](Worker& w){
+                LOG_WARN("Cluster : lost worker " << w.host << ":" << w.port);
+                if(w.unit >= 0){ queue.push_front(w.unit); } // 他のワーカーにやり直させる
+                w.unit = -1;
+                w.socket.close();
+            };
+            auto assign = [&](){
+                for(Worker& w : workers_){
+                    if(queue.empty()){ break; }
+                    if(!w.socket.valid() || w.unit >= 0){ continue; }
+                    const int i = queue.front();
+                    queue.pop_front();
+                    // 残り時間と残りの単位数から、全体でおよそ制限時間に収まるように決める
+                    const int64_t now = clock.stop() / 1000;
+                    const int64_t rest = timeLimitMs - now;
+                    const int64_t unitTime = std::max(int64_t(10), std::min(rest, rest * alive() / (units - done)));
+                    std::ostringstream oss;
+                    oss << "unit " << i << " " << depth << " " << unitTime << " " << rootMoves[i].move << " " << position;
+                    w.unit = i;
+                    w.deadline = now + unitTime + CLUSTER_MARGIN_MS;
+                    if(!w.socket.send(oss.str())){ lost(w); }
+                }
+            };
+            
+            while(done < units){
+                const int64_t now = clock.stop() / 1000;
+                for(Worker& w : workers_){
+                    if(w.socket.valid() && w.unit >= 0 && now > w.deadline){
+                        LOG_WARN("Cluster : no result for unit " << w.unit << " in time");
+                        lost(w);
+                    }
+                }
+                if(now > limit){ break; }
+                assign();
+                std::vector<pollfd> fds;
+                std::vector<Worker*> polled;
+                int64_t wait = limit - now;
+                for(Worker& w : workers_){
+                    if(w.socket.valid()){
+                        fds.push_back(pollfd{w.socket.fd_, POLLIN, 0});
+                        polled.push_back(&w);
+                        if(w.unit >= 0){ wait = std::min(wait, w.deadline - now); }
+                    }
+                }
+                if(fds.empty()){ return false; }
+                wait = std::max(int64_t(1), std::min(int64_t(1000), wait + 1));
+                if(poll(fds.data(), fds.size(), int(wait)) < 0){
+                    if(errno == EINTR){ continue; }
+                    return false;
+                }
+                for(size_t k = 0; k < fds.size(); ++k){
+                    if(!fds[k].revents){ continue; }
+                    Worker& w = *polled[k];
+                    if(!w.socket.receive()){ lost(w); continue; }
+                    std::string line;
+                    while(w.socket.pop(&line)){
+                        std::istringstream iss(line);
+                        std::string command;
+                        int id, value, searchDepth;
+                        int64_t nodes;
+                        iss >> command >> id >> value >> nodes >> searchDepth;
+                        if(!iss || command != "result" || id != w.unit){
+                            LOG_WARN("Cluster : unexpected message " << line);
+                            continue;
+                        }
+                        rootMoves[id].value = Value(value);
+                        rootMoves[id].nodes = nodes;
+                        rootMoves[id].searchDepth = searchDepth;
+                        *pnodes += nodes;
+                        w.unit = -1;
+                        finished[id] = true;
+                        done += 1;
+                    }
+                }
+            }
+            if(done < units){
+                // 遅れている結果が次の局面の探索に混ざらないように切る
+                for(Worker& w : workers_){
+                    if(w.unit >= 0){ lost(w); }
+                }
+                LOG_WARN("Cluster : time up with " << done << " / " << units << " results");
+                if(done == 0){ return false; }
+                for(int i = 0; i < units; ++i){
+                    if(!finished[i]){ rootMoves[i].value = -VALUE_INFINITE; }
+                }
+            }
+            return true;
+        }
+    };
+}
+
+#endif // DAB_CLUSTER_HPP_
\ No newline at end of file
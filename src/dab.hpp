@@ -32,6 +32,8 @@
 #include <string>
 #include <bitset>
 #include <numeric>
+#include <limits>
+#include <immintrin.h>
 
 #ifdef _WIN32
 
@@ -82,12 +84,21 @@ constexpr std::size_t N_THREADS = 8;
 #include "../CppCommon/src/util/softmaxPolicy.hpp"
 #include "../CppCommon/src/util/lock.hpp"
 
+#include "log.hpp"
+
 namespace DotsAndBoxes{
     
     /**************************設定**************************/
     
-    constexpr int LENGTH_X = 5;
-    constexpr int LENGTH_Y = 5;
+#ifndef BOARD_LENGTH_X
+#define BOARD_LENGTH_X 5
+#endif
+#ifndef BOARD_LENGTH_Y
+#define BOARD_LENGTH_Y 5
+#endif
+    
+    constexpr int LENGTH_X = BOARD_LENGTH_X;
+    constexpr int LENGTH_Y = BOARD_LENGTH_Y;
     
     /**************************基本的定義**************************/
     
@@ -125,6 +136,9 @@ namespace DotsAndBoxes{
     constexpr int z2x(int z)noexcept{ return z / LY; }
     constexpr int z2y(int z)noexcept{ return z % LY; }
     constexpr int xy2z(int x, int y)noexcept{ return x * LY + y; }
+    constexpr bool inBoard(int z)noexcept{ // 外周の番兵マスでない
+        return 1 <= z2x(z) && z2x(z) < LX - 1 && 1 <= z2y(z) && z2y(z) < LY - 1;
+    }
     
     enum Color{
         B = 0, W = 1
@@ -288,8 +302,173 @@ namespace DotsAndBoxes{
         ExtMove(const ExtMove& aemv): data_(aemv.data_){}
     };*/
     
+    /**************************評価関数の入力層**************************/
+    
+    // 線1本が入力1つに対応するので、線を引く/戻す度に差分で更新できる
+    constexpr int NN_FEATURES = 2 * CELLS; // (vh, mz)
+    constexpr int NN_HIDDEN = 64;
+    
+    struct NNFeatureWeights{
+        int16_t bias[NN_HIDDEN];
+        int16_t weight[NN_FEATURES][NN_HIDDEN];
+    };
+    alignas(32) NNFeatureWeights nnFeature;
+    bool nnLoaded = false; // 重みが読み込まれていなければ更新しない
+    
+    struct NNAccumulator{
+        int16_t v[NN_HIDDEN];
+        
+        void clear()noexcept{
+            memcpy(v, nnFeature.bias, sizeof(v));
+        }
+        void add(VH vh, int mz)noexcept{
+            update<true>(nnFeature.weight[vh * CELLS + mz]);
+        }
+        void remove(VH vh, int mz)noexcept{
+            update<false>(nnFeature.weight[vh * CELLS + mz]);
+        }
+        template<bool ADD>
+        void update(const int16_t *w)noexcept{
+#ifdef __AVX2__
+            for(int i = 0; i < NN_HIDDEN; i += 16){
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+                a = ADD ? _mm256_add_epi16(a, b) : _mm256_sub_epi16(a, b);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i), a);
+            }
+#else
+            for(int i = 0; i < NN_HIDDEN; ++i){
+                v[i] += ADD ? w[i] : -w[i];
+            }
+#endif
+        }
+    };
+    
+    /**************************パターン評価**************************/
+    
+    // 数マスの領域の周りの線の有無を pext で1つの番号にまとめ、番号ごとの重みの和を評価に使う
+    // 番号は領域内の線を縦線、横線の順に z の小さい方から並べたものなので、
+    // 平行移動しても同じ意味になり、同じ形の領域は位置によらず同じ表を引く
+    enum PatternShape{
+        PT_2X2, PT_3X1, PT_1X3, PT_SHAPES
+    };
+    constexpr int ptWidth[PT_SHAPES] = {2, 3, 1}; // x 方向のマス数
+    constexpr int ptHeight[PT_SHAPES] = {2, 1, 3};
+    constexpr int ptVLines(int s){ return ptWidth[s] * (ptHeight[s] + 1); }
+    constexpr int ptLines(int s){ return ptVLines(s) + (ptWidth[s] + 1) * ptHeight[s]; }
+    constexpr int ptTableOffset(int s){ return s <= 0 ? 0 : ptTableOffset(s - 1) + (1 << ptLines(s - 1)); }
+    constexpr int PT_TABLE_SIZE = ptTableOffset(PT_SHAPES); // 全形の表の合計 (12KB)
+    constexpr int PT_SCALE = 64; // 重み / PT_SCALE がマス数
+    
+    alignas(64) int16_t ptWeight[PT_TABLE_SIZE];
+    bool ptLoaded = false; // 重みが読み込まれていなければ更新しない
+    
+    struct PatternInstance{
+        uint64_t mask[2]; // 領域内の線 (vh ごと)
+        int vlines; // 縦線の数 (横線の番号のずらし幅)
+        int offset; // 表の位置
+    };
+    struct PatternRef{ // 線 -> その線を含む領域と番号の中での桁
+        uint16_t instance, bit;
+    };
+    constexpr int PT_MAX_REFS = 16;
+    std::vector<PatternInstance> ptInstances;
+    PatternRef ptRefs[2][CELLS][PT_MAX_REFS];
+    int ptNumRefs[2][CELLS];
+    
+    uint64_t pext64(uint64_t a, uint64_t mask)noexcept{
+#ifdef __BMI2__
+        return _pext_u64(a, mask);
+#else
+        uint64_t r = 0;
+        for(uint64_t bit = 1; mask; mask &= mask - 1, bit <<= 1){
+            if(a & mask & -mask){ r |= bit; }
+        }
+        return r;
+#endif
+    }
+    template<class lineSet_t>
+    int patternIndex(const PatternInstance& pi, const lineSet_t& lineSet)noexcept{
+        return pi.offset + int(pext64(uint64_t(lineSet[0]), pi.mask[0])
+                               | (pext64(uint64_t(lineSet[1]), pi.mask[1]) << pi.vlines));
+    }
+    
+    void initPatterns(){
+        ptInstances.clear();
+        memset(ptNumRefs, 0, sizeof(ptNumRefs));
+        for(int s = 0; s < PT_SHAPES; ++s){
+            // 左上のマス (x0, y0) を動かす
+            for(int x0 = 1; x0 + ptWidth[s] <= LX - 1; ++x0){
+                for(int y0 = 1; y0 + ptHeight[s] <= LY - 1; ++y0){
+                    PatternInstance pi;
+                    pi.mask[0] = pi.mask[1] = 0;
+                    pi.vlines = ptVLines(s);
+                    pi.offset = ptTableOffset(s);
+                    for(int x = x0; x < x0 + ptWidth[s]; ++x){
+                        for(int y = y0 - 1; y < y0 + ptHeight[s]; ++y){
+                            pi.mask[V] |= 1ULL << xy2z(x, y);
+                        }
+                    }
+                    for(int x = x0 - 1; x < x0 + ptWidth[s]; ++x){
+                        for(int y = y0; y < y0 + ptHeight[s]; ++y){
+                            pi.mask[H] |= 1ULL << xy2z(x, y);
+                        }
+                    }
+                    const int i = ptInstances.size();
+                    for(VH vh = VH(0); (int)vh < 2; ++vh){
+                        int bit = (vh == V) ? 0 : pi.vlines;
+                        for(uint64_t rest = pi.mask[vh]; rest; rest &= rest - 1, ++bit){
+                            const int mz = bsf64(rest);
+                            ASSERT(ptNumRefs[vh][mz] < PT_MAX_REFS, cerr << "initPatterns() : too many refs" << endl;);
+                            ptRefs[vh][mz][ptNumRefs[vh][mz]++] = PatternRef{uint16_t(i), uint16_t(bit)};
+                        }
+                    }
+                    ptInstances.push_back(pi);
+                }
+            }
+        }
+    }
+    
+    // 盤面全体の重みの和
+    struct PatternAccumulator{
+        int32_t sum;
+        
+        template<class lineSet_t>
+        void refresh(const lineSet_t& lineSet)noexcept{ // 1から計算
+            sum = 0;
+            for(const PatternInstance& pi : ptInstances){
+                sum += ptWeight[patternIndex(pi, lineSet)];
+            }
+        }
+        // 線 (vh, mz) を引いた/戻した後に呼ぶ
+        // 変化した領域の番号は1桁違うだけなので、前の番号も今の番号から分かる
+        template<class lineSet_t>
+        void update(const lineSet_t& lineSet, VH vh, int mz)noexcept{
+            for(int r = 0; r < ptNumRefs[vh][mz]; ++r){
+                const PatternRef& ref = ptRefs[vh][mz][r];
+                const int index = patternIndex(ptInstances[ref.instance], lineSet);
+                sum += ptWeight[index] - ptWeight[index ^ (1 << ref.bit)];
+            }
+        }
+    };
+    
     /**************************盤面**************************/
     
+    // 線の集合は (vh, mz) の mz をビット位置として持つ
+    static_assert(CELLS <= 64, "line sets must fit in 64 bits");
+    
+    // 着手できる位置 (番兵マスの外側の線を除く)
+    constexpr uint64_t genValidLineMask(VH vh){
+        uint64_t mask = 0;
+        for(int x = (vh == V) ? 1 : 0; x < LX - 1; ++x){
+            for(int y = (vh == V) ? 0 : 1; y < LY - 1; ++y){
+                mask |= 1ULL << xy2z(x, y);
+            }
+        }
+        return mask;
+    }
+    constexpr uint64_t validLineMask[2] = {genValidLineMask(V), genValidLineMask(H)};
+    
     uint64_t lineKeyTable[CELLS][2];
     
     template<class board_t>
@@ -325,6 +504,7 @@ namespace DotsAndBoxes{
         int ply, turn;
         int occupied[CELLS];
         int area[2];
+        BitSet64 lineSet[2]; // 引かれた線のビット集合
         
         bool filled()const{ return ply >= MAX_PLY; }
         bool full(int z)const{ return occupied[z] == 15; }
@@ -332,18 +512,23 @@ namespace DotsAndBoxes{
         bool line(int z, Direction dir)const{ return (occupied[z] >> dir) & 1; }
         Color turnColor()const{ return Color(turn % 2); }
         Color winner()const{ return area[B] > area[W] ? B : W; }
+        uint64_t undrawnLines(VH vh)const noexcept{ // まだ引かれていない線
+            return ~uint64_t(lineSet[vh]) & validLineMask[vh];
+        }
         
         MiniBoard(){}
         MiniBoard(const Board&);
         void clear(){
             memset(occupied, 0, sizeof(occupied));
             ply = turn = area[0] = area[1] = 0;
+            lineSet[V] = lineSet[H] = 0;
         }
         void move(Move mv){
             int newArea = 0;
             VH vh = mv.vh;
             int mz = mv.mz;
             int tz;
+            lineSet[vh].set(mz);
             for(int b = 0; b < 2; ++b){
                 Direction dir = besideLineDirection[mv.vh][b];
                 tz = mz + move2cellDZ[dir];
@@ -414,6 +599,8 @@ namespace DotsAndBoxes{
         int numReaches; // リーチの数
         //std::priority_queue<ReachInfo> reach;
         int immediateReachEffect; // 1 turn で即取れる得点の下界
+        NNAccumulator accumulator; // 評価関数の入力層の出力
+        PatternAccumulator pattern; // パターン評価の重みの和
         
         
         bool filled()const{ return ply >= MAX_PLY; }
@@ -425,8 +612,8 @@ namespace DotsAndBoxes{
             return area[turnColor()] + immediateReachEffect > SIZE / 2;
         }
         uint64_t key()const noexcept{
-            Color c = turnColor();
-            return (lineKey & 0x000FFFFFFFFFFFFF) | (area[c] << 58) | (area[~c] << 52);
+            // 以降の展開は線の配置のみで決まるので陣地数は含めない
+            return lineKey;
         }
         int count(int z)const{ return cell[z].count(); }
         int areaDiff(Color c)const noexcept{
@@ -436,20 +623,21 @@ namespace DotsAndBoxes{
         Color winner()const noexcept{
             return area[B] > area[W] ? B : W;
         }
+        uint64_t undrawnLines(VH vh)const noexcept{ // まだ引かれていない線
+            return ~uint64_t(lineSet[vh]) & validLineMask[vh];
+        }
         bool valid(Move mv)const noexcept{
             Direction dir = besideLineDirection[mv.vh][0];
             return !line(mv.mz + move2cellDZ[dir], opposite(dir));
         }
         
+        Board(){ clear(); }
         Board(const MiniBoard& mbd){
             ply = mbd.ply; turn = mbd.turn;
             area[0] = mbd.area[0]; area[1] = mbd.area[1];
             // 線の情報
-            lineSet[0] = lineSet[1] = 0;
-            for(int z = 0; z < CELLS; ++z){
-                if(mbd.line(z, DIR_2)){ lineSet[H].set(z); }
-                if(mbd.line(z, DIR_3)){ lineSet[V].set(z); }
-            }
+            lineSet[V] = mbd.lineSet[V];
+            lineSet[H] = mbd.lineSet[H];
             lineKey = genLineKey(mbd);
             // マスの情報
             for(int z = 0; z < CELLS; ++z){
@@ -464,6 +652,17 @@ namespace DotsAndBoxes{
                     addReach(z);
                 }
             }
+            if(nnLoaded){ refreshAccumulator(); }
+            if(ptLoaded){ pattern.refresh(lineSet); }
+        }
+        
+        void refreshAccumulator()noexcept{ // 1から計算
+            accumulator.clear();
+            for(VH vh = VH(0); (int)vh < 2; ++vh){
+                for(int mz = 0; mz < CELLS; ++mz){
+                    if(lineSet[vh].get(mz)){ accumulator.add(vh, mz); }
+                }
+            }
         }
         
         // リーチ関係
@@ -476,12 +675,12 @@ namespace DotsAndBoxes{
             reachInfo[numReaches] = ri;
             numReaches += 1;
             immediateReachEffect += ri.effect;
-            DERR << "add reach " << z2string(z) << " " << cell[z].reachIndex << endl;
+            LOG_TRACE("add reach " << z2string(z) << " " << cell[z].reachIndex);
         }
         void removeReach(int z){
             int reachIndex = cell[z].reachIndex;
-            DERR << "remove reach " << z2string(z) << " " << reachIndex << endl;
-            immediateReachEffect -= reachInfo[numReaches].effect;
+            LOG_TRACE("remove reach " << z2string(z) << " " << reachIndex);
+            immediateReachEffect -= reachInfo[reachIndex].effect;
             --numReaches;
             reachInfo[reachIndex] = reachInfo[numReaches];
             cell[reachInfo[reachIndex].z].reachIndex = reachIndex; // リーチ番号変更
@@ -503,6 +702,8 @@ namespace DotsAndBoxes{
             ply = turn = 0;
             lineKey = 0;
             clearReach();
+            if(nnLoaded){ accumulator.clear(); }
+            if(ptLoaded){ pattern.refresh(lineSet); }
         }
         int move(VH vh, int mz){
             int newArea = 0;
@@ -516,25 +717,28 @@ namespace DotsAndBoxes{
                 }else if(cell[tz].reach()){ addReach(tz); }
             }
             lineKey ^= lineKeyTable[mz][vh];
+            if(nnLoaded){ accumulator.add(vh, mz); }
+            if(ptLoaded){ pattern.update(lineSet, vh, mz); }
             ply += 1;
             if(!newArea){
                 turn += 1;
             }else{
                 area[turnColor()] += newArea;
             }
-            DERR << toString();
+            LOG_TRACE(toString());
             ASSERT(exam(), cerr << toString() << endl;);
             return newArea;
         }
         int move(Move mv){
             ASSERT(valid(mv), cerr << mv << " is not valid." << endl;);
-            DERR << "move " << turnColor() << " " << mv << endl;
+            LOG_TRACE("move " << turnColor() << " " << mv);
             return move(mv.vh, mv.mz);
         }
         void unmove(VH vh, int mz){
             int newArea = 0;
             int tz;
             lineKey ^= lineKeyTable[mz][vh];
+            if(nnLoaded){ accumulator.remove(vh, mz); }
             for(int b = 1; b >= 0; --b){
                 Direction dir = besideLineDirection[vh][b];
                 tz = mz + move2cellDZ[dir];
@@ -543,6 +747,7 @@ namespace DotsAndBoxes{
                 cell[tz].removeLine(opposite(dir));
                 lineSet[vh].reset(mz);
             }
+            if(ptLoaded){ pattern.update(lineSet, vh, mz); }
             ply -= 1;
             if(!newArea){
                 turn -= 1;
@@ -552,7 +757,7 @@ namespace DotsAndBoxes{
             ASSERT(exam(), cerr << toString() << endl;);
         }
         void unmove(Move mv){
-            DERR << "unmove " << mv << endl;
+            LOG_TRACE("unmove " << mv);
             return unmove(mv.vh, mv.mz);
         }
         
@@ -576,6 +781,21 @@ namespace DotsAndBoxes{
                     }
                 }
             }
+            if(ptLoaded){
+                PatternAccumulator fresh;
+                fresh.refresh(lineSet);
+                if(fresh.sum != pattern.sum){
+                    cerr << "Board::exam() : inconsistent pattern sum ";
+                    cerr << pattern.sum << " <-> " << fresh.sum << endl;
+                    return false;
+                }
+            }
+            int undrawn = countBits64(undrawnLines(V)) + countBits64(undrawnLines(H));
+            if(undrawn != MAX_PLY - ply){
+                cerr << "Board::exam() : inconsistent lineSet against ply ";
+                cerr << undrawn << " <-> " << (MAX_PLY - ply) << endl;
+                return false;
+            }
             // 隣接マス同士の情報確認
             for(int x = 1; x < LX - 1; ++x){
                 for(int y = 1; y < LY - 1; ++y){
@@ -622,11 +842,13 @@ namespace DotsAndBoxes{
             for(int r = 0; r < numReaches; ++r){
                 oss << r << " " << z2string(reachInfo[r].z) << " " << reachInfo[r].effect << endl;
             }
-            for(int x = 0; x < LX; ++x){
-                for(int y = 0; y < LY; ++y){
-                    DERR << " " << count(xy2z(x, y));
+            if(LOG_ENABLED(LOG_LEVEL_TRACE)){
+                for(int x = 0; x < LX; ++x){
+                    for(int y = 0; y < LY; ++y){
+                        oss << " " << count(xy2z(x, y));
+                    }
+                    oss << endl;
                 }
-                DERR << endl;
             }
             return oss.str();
         }
@@ -636,11 +858,53 @@ namespace DotsAndBoxes{
         memset(occupied, 0, sizeof(occupied));
         ply = bd.ply; turn = bd.turn;
         area[0] = bd.area[0]; area[1] = bd.area[1];
+        lineSet[V] = bd.lineSet[V];
+        lineSet[H] = bd.lineSet[H];
         for(int z = 0; z < CELLS; ++z){
             occupied[z] = bd.cell[z].occupied;
         }
     }
     
+    /**************************対局**************************/
+    
+    // 対局中の盤面と着手の履歴
+    // 1手ずつ進める/戻すので、毎手記録から局面を作り直さない
+    struct GameSession{
+        Board board;
+        std::vector<Move> history;
+        
+        GameSession(){ history.reserve(MAX_PLY); }
+        
+        void clear(){
+            board.clear();
+            history.clear();
+        }
+        int ply()const noexcept{ return history.size(); }
+        bool legal(Move mv)const noexcept{
+            return 0 <= mv.mz && mv.mz < CELLS && ((board.undrawnLines(mv.vh) >> mv.mz) & 1);
+        }
+        int apply(Move mv){
+            history.push_back(mv);
+            return board.move(mv);
+        }
+        bool undo(){
+            if(history.empty()){ return false; }
+            board.unmove(history.back());
+            history.pop_back();
+            return true;
+        }
+        void undoTo(int aply){
+            while(ply() > aply){ undo(); }
+        }
+        // 色 c の直近の着手までを取り消す (c の手番に戻る)
+        bool undoTurn(Color c){
+            while(undo()){
+                if(board.turnColor() == c){ return true; }
+            }
+            return false;
+        }
+    };
+    
     /**************************盤面出力**************************/
     
     std::ostream& operator <<(std::ostream& ost, const MiniBoard& bd){
@@ -655,24 +919,48 @@ namespace DotsAndBoxes{
     
     /**************************合法手**************************/
     
+    // 引かれていない線のビット集合を下位から順に取り出す (縦線、横線の順)
     template<class move_t, class board_t>
     int genAllMoves(move_t *const pmv0, const board_t& bd){
-        // とりあえず全部生成
         move_t *pmv = pmv0;
-        for(int x = 1; x < LX - 1; ++x){
-            for(int y = 0; y < LY - 1; ++y){
-                int z = xy2z(x, y);
-                if(!bd.line(z, DIR_3)){
-                    pmv->set(V, z); ++pmv;
-                }
+        for(VH vh = VH(0); (int)vh < 2; ++vh){
+            for(uint64_t rest = bd.undrawnLines(vh); rest; rest &= rest - 1){
+                pmv->set(vh, bsf64(rest)); ++pmv;
             }
         }
-        for(int x = 0; x < LX - 1; ++x){
-            for(int y = 1; y < LY - 1; ++y){
-                int z = xy2z(x, y);
-                if(!bd.line(z, DIR_2)){
-                    pmv->set(H, z); ++pmv;
-                }
+        return pmv - pmv0;
+    }
+    
+    // 手の数のみ
+    template<class board_t>
+    int countAllMoves(const board_t& bd){
+        return countBits64(bd.undrawnLines(V)) + countBits64(bd.undrawnLines(H));
+    }
+    
+    // 静止探索用 : 箱を取る手と、連鎖の末端で2マスを渡す手 (double-dealing)
+    template<class move_t>
+    int genQuiescenceMoves(move_t *const pmv0, const Board& bd){
+        move_t *pmv = pmv0;
+        uint64_t generated[2] = {0}; // 重複除去
+        auto add = [&](Move move){
+            if(!((generated[move.vh] >> move.mz) & 1)){
+                generated[move.vh] |= 1ULL << move.mz;
+                *pmv = move; ++pmv;
+            }
+        };
+        for(int r = 0; r < bd.numReaches; ++r){
+            const int z = bd.reachInfo[r].z;
+            add(fillMove(bd.cell[z], z));
+        }
+        for(int r = 0; r < bd.numReaches; ++r){
+            // 取れるマスの先が2辺のマスなら、その反対側の線を引いて2マスを渡せる
+            const int z = bd.reachInfo[r].z;
+            const Direction dir = Direction(bsf32(~bd.cell[z].occupied));
+            const int tz = z + dirDZ[dir];
+            if(inBoard(tz) && bd.count(tz) == 2){
+                CellInfo tcell = bd.cell[tz];
+                tcell.addLine(opposite(dir));
+                add(fillMove(tcell, tz));
             }
         }
         return pmv - pmv0;
@@ -681,15 +969,18 @@ namespace DotsAndBoxes{
     /**************************初期化**************************/
     
     void initHash(){
+        // dice() は 32bit なので、キー全体に乱数が入るように 64bit の生成器を使う
+        std::mt19937_64 keyDice(dice());
         for(int z = 0; z < CELLS; ++z){
-            lineKeyTable[z][V] = dice();
-            lineKeyTable[z][H] = dice();
+            lineKeyTable[z][V] = keyDice();
+            lineKeyTable[z][H] = keyDice();
         }
     }
     
     struct DABInitializer{
         DABInitializer(){
             initHash();
+            initPatterns();
         }
     };
     
@@ -5,20 +5,451 @@
 
 #include "dab.hpp"
 #include "agent.hpp"
+#include "dfpn.hpp"
+
+using namespace DotsAndBoxes;
+
+// 比較用 : マスを順に見て線が引かれているか調べる
+template<class board_t>
+int genAllMovesByCell(Move *const pmv0, const board_t& bd){
+    Move *pmv = pmv0;
+    for(int x = 1; x < LX - 1; ++x){
+        for(int y = 0; y < LY - 1; ++y){
+            int z = xy2z(x, y);
+            if(!bd.line(z, DIR_3)){ pmv->set(V, z); ++pmv; }
+        }
+    }
+    for(int x = 0; x < LX - 1; ++x){
+        for(int y = 1; y < LY - 1; ++y){
+            int z = xy2z(x, y);
+            if(!bd.line(z, DIR_2)){ pmv->set(H, z); ++pmv; }
+        }
+    }
+    return pmv - pmv0;
+}
+
+template<class board_t, class generator_t>
+void benchGenMoves(const std::vector<board_t>& boards, const std::string& name,
+                   const generator_t& generator){
+    const int N = 2000;
+    int64_t sum = 0;
+    ClockMicS clock;
+    clock.start();
+    for(int n = 0; n < N; ++n){
+        for(const board_t& bd : boards){ sum += generator(bd); }
+    }
+    const double ns = clock.stop() * 1000.0 / (N * boards.size());
+    cerr << std::setw(24) << std::left << name << std::fixed << std::setprecision(2);
+    cerr << ns << " ns/call (" << sum << ")" << endl;
+}
+
+// 合法手生成の速度計測
+int benchmark(){
+    std::vector<MiniBoard> miniBoards;
+    std::vector<Board> boards;
+    for(int i = 0; i < 1024; ++i){
+        MiniBoard mbd;
+        mbd.clear();
+        int numLines = dice() % MAX_PLY;
+        for(int l = 0; l < numLines; ++l){
+            mbd.move(std::get<0>(randomMove(mbd)));
+        }
+        miniBoards.push_back(mbd);
+        boards.push_back(Board(mbd));
+    }
+    // 生成結果が以前と同じか確認
+    for(const Board& bd : boards){
+        Move buffer0[MAX_MOVES], buffer1[MAX_MOVES];
+        int n0 = genAllMovesByCell(buffer0, bd);
+        int n1 = genAllMoves(buffer1, bd);
+        if(n0 != n1 || n1 != countAllMoves(bd) || n1 != MAX_PLY - bd.ply
+           || !std::equal(buffer0, buffer0 + n0, buffer1)){
+            cerr << "benchmark() : inconsistent moves" << endl << bd << endl;
+            return 1;
+        }
+    }
+    Move buffer[MAX_MOVES];
+    benchGenMoves(boards, "Board by cell",
+                  [&](const Board& bd){ return genAllMovesByCell(buffer, bd); });
+    benchGenMoves(boards, "Board by bits",
+                  [&](const Board& bd){ return genAllMoves(buffer, bd); });
+    benchGenMoves(boards, "Board count",
+                  [&](const Board& bd){ return countAllMoves(bd); });
+    benchGenMoves(miniBoards, "MiniBoard by cell",
+                  [&](const MiniBoard& bd){ return genAllMovesByCell(buffer, bd); });
+    benchGenMoves(miniBoards, "MiniBoard by bits",
+                  [&](const MiniBoard& bd){ return genAllMoves(buffer, bd); });
+    benchGenMoves(miniBoards, "MiniBoard count",
+                  [&](const MiniBoard& bd){ return countAllMoves(bd); });
+    return 0;
+}
+
+// minLines 本以上 maxLines 本以下の線をランダムに引いた局面
+MiniBoard randomBoard(std::mt19937& rng, int minLines, int maxLines){
+    MiniBoard mbd;
+    mbd.clear();
+    const int numLines = minLines + rng() % (maxLines - minLines + 1);
+    Move buffer[MAX_MOVES];
+    for(int l = 0; l < numLines; ++l){
+        mbd.move(buffer[rng() % genAllMoves(buffer, mbd)]);
+    }
+    return mbd;
+}
+
+// 相手に取れる箱を渡さない手が無くなるまでランダムに線を引いた局面
+MiniBoard quietRandomBoard(std::mt19937& rng){
+    MiniBoard mbd;
+    mbd.clear();
+    Board bd(mbd);
+    Move buffer[MAX_MOVES];
+    while(true){
+        const int moves = genAllMoves(buffer, bd);
+        std::shuffle(buffer, buffer + moves, rng);
+        int m = 0;
+        for(; m < moves; ++m){
+            bd.move(buffer[m]);
+            if(bd.numReaches == 0){ break; }
+            bd.unmove(buffer[m]);
+        }
+        if(m == moves){ break; }
+    }
+    return MiniBoard(bd);
+}
+
+// 選択的探索の有無での比較
+// 同じ局面を同じ深さで読んだときのノード数と、同じノード数で指したときの勝敗を見る
+int compareSelective(int depth, int games, int64_t nodeLimit){
+    std::mt19937 rng(1); // 毎回同じ局面で比べる
+    SearchAgent *const pa[2] = {new SearchAgent(1000000), new SearchAgent(1000000)};
+    for(int i = 0; i < 2; ++i){
+        pa[i]->verbose = false;
+        pa[i]->setSelective(i == 1);
+    }
+    
+    // 固定深さでのノード数
+    int64_t nodes[2] = {0}, time[2] = {0};
+    int sameMove = 0, sameValue = 0;
+    const int positions = 32;
+    for(int p = 0; p < positions; ++p){
+        const MiniBoard mbd = randomBoard(rng, MAX_PLY / 4, MAX_PLY / 2);
+        std::tuple<Move, Value> result[2];
+        for(int i = 0; i < 2; ++i){
+            pa[i]->initialize();
+            result[i] = pa[i]->searchMove(mbd, depth);
+            nodes[i] += pa[i]->nodes;
+            time[i] += pa[i]->clock.stop();
+        }
+        sameMove += std::get<0>(result[0]) == std::get<0>(result[1]);
+        sameValue += std::get<1>(result[0]) == std::get<1>(result[1]);
+    }
+    for(int i = 0; i < 2; ++i){
+        LOG_INFO((i ? "selective" : "full     ") << " nodes " << nodes[i]
+                 << " time " << time[i] / 1000 << " ms");
+    }
+    LOG_INFO("depth " << depth << " same move " << sameMove << " / " << positions
+             << " same value " << sameValue << " / " << positions);
+    
+    // 同じノード数での対戦 (先後を入れ替える)
+    int w[3] = {0}; // 選択的探索から見た勝ち、引き分け、負け
+    for(int g = 0; g < games; ++g){
+        MiniBoard mbd = randomBoard(rng, 0, 7);
+        const Color selectiveColor = Color(g % 2);
+        for(int i = 0; i < 2; ++i){
+            pa[i]->initialize();
+            pa[i]->setNodeLimit(nodeLimit);
+        }
+        while(!mbd.filled()){
+            SearchAgent *const a = pa[mbd.turnColor() == selectiveColor];
+            mbd.move(std::get<0>(a->searchMove(mbd, MAX_PLY)));
+        }
+        const int diff = mbd.area[selectiveColor] - mbd.area[~selectiveColor];
+        w[diff > 0 ? 0 : (diff == 0 ? 1 : 2)] += 1;
+    }
+    if(games > 0){
+        LOG_INFO("selective vs full (" << nodeLimit << " nodes/move) "
+                 << w[0] << " - " << w[1] << " - " << w[2]);
+    }
+    delete pa[0]; delete pa[1];
+    return 0;
+}
+
+// 探索量の回帰確認
+// 中盤の局面を終局まで読み切り、合計ノード数が上限を越えれば失敗とする
+// 上限の既定値は 5x5 の盤で、置換表が詰みの結果を使えていれば十分に下回る値
+int checkNodes(int positions, int64_t limit){
+    std::mt19937 rng(1);
+    SearchAgent *const pa = new SearchAgent(1000000); // 時間では打ち切らない
+    pa->verbose = false;
+    int64_t nodes = 0;
+    ClockMicS clock;
+    clock.start();
+    for(int p = 0; p < positions; ++p){
+        const MiniBoard mbd = randomBoard(rng, MAX_PLY * 2 / 5, MAX_PLY / 2);
+        pa->initialize();
+        pa->searchMove(mbd, MAX_PLY);
+        nodes += pa->nodes;
+    }
+    delete pa;
+    LOG_INFO(positions << " positions nodes " << nodes << " (limit " << limit << ")"
+             << " time " << clock.stop() / 1000 << " ms");
+    if(nodes > limit){
+        cerr << "checkNodes() : too many nodes" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 評価関数の確認
+// AVX2 と SIMD を使わない計算の出力、差分更新した入力層と1から足し直した値が一致するかを見る
+// 重みのファイルを指定しなければ乱数の重みを使う
+int checkNNUE(const char *path, int games){
+    if(path != nullptr){
+        if(!loadNNUE(path)){ return 1; }
+    }else{
+        std::mt19937 rng(1);
+        for(int16_t& b : nnFeature.bias){ b = int16_t(int(rng() % 129) - 32); }
+        for(auto& w : nnFeature.weight){
+            for(int16_t& x : w){ x = int16_t(int(rng() % 33) - 16); }
+        }
+        for(int32_t& b : nnNetwork.l2Bias){ b = int(rng() % 4097) - 2048; }
+        for(auto& w : nnNetwork.l2Weight){
+            for(int8_t& x : w){ x = int8_t(int(rng() % 256) - 128); }
+        }
+        nnNetwork.outBias = int(rng() % 4097) - 2048;
+        for(int8_t& x : nnNetwork.outWeight){ x = int8_t(int(rng() % 256) - 128); }
+        nnNetwork.outputScale = 64;
+        nnLoaded = true;
+    }
+#ifndef __AVX2__
+    LOG_WARN("checkNNUE() : built without AVX2, both outputs are scalar");
+#endif
+    std::mt19937 rng(1);
+    int64_t positions = 0, badAccumulator = 0, badOutput = 0;
+    MiniBoard empty;
+    empty.clear();
+    const Board emptyBoard(empty);
+    for(int g = 0; g < games; ++g){
+        Board bd(empty);
+        std::vector<Move> history;
+        Move buffer[MAX_MOVES];
+        while(!bd.filled()){
+            const Move move = buffer[rng() % genAllMoves(buffer, bd)];
+            bd.move(move);
+            history.push_back(move);
+            // 入力層を1本ずつ足し直す
+            int16_t v[NN_HIDDEN];
+            memcpy(v, nnFeature.bias, sizeof(v));
+            for(VH vh = VH(0); (int)vh < 2; ++vh){
+                for(int mz = 0; mz < CELLS; ++mz){
+                    if(!bd.lineSet[vh].get(mz)){ continue; }
+                    for(int i = 0; i < NN_HIDDEN; ++i){ v[i] += nnFeature.weight[vh * CELLS + mz][i]; }
+                }
+            }
+            badAccumulator += memcmp(v, bd.accumulator.v, sizeof(v)) != 0;
+            badOutput += nnForward<true>(bd.accumulator) != nnForward<false>(bd.accumulator);
+            positions += 1;
+        }
+        // 全て戻せば初期局面と同じになる
+        while(!history.empty()){
+            bd.unmove(history.back());
+            history.pop_back();
+        }
+        badAccumulator += memcmp(emptyBoard.accumulator.v, bd.accumulator.v, sizeof(bd.accumulator.v)) != 0;
+    }
+    LOG_INFO(positions << " positions accumulator mismatches " << badAccumulator
+             << " output mismatches " << badOutput);
+    if(badAccumulator > 0 || badOutput > 0){
+        cerr << "checkNNUE() : inconsistent evaluation" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 後退解析の表から引いた局面の値 (手番側から見た終局時の陣地差)
+int solvedValue(const SolutionTable& table, const Board& bd){
+    return table.get(lineSetIndex(bd)) + bd.areaDiff(bd.turnColor());
+}
+
+// 証明数探索の確認
+// 表を作った大きさの盤で、表の値の前後の閾値について証明の結果と証明した手が正しいかを見る
+// 節点数の上限で打ち切った証明は数えるだけにする
+int checkDfpn(const char *path, int positions){
+    SolutionTable table;
+    if(!table.open(path)){ return 1; }
+    if(!table.matches(LENGTH_X, LENGTH_Y)){
+        cerr << "checkDfpn() : the table is not for " << LENGTH_X << "x" << LENGTH_Y << endl;
+        return 1;
+    }
+    DfpnSolver solver(64 << 20, 2000000);
+    std::mt19937 rng(1);
+    int proofs = 0, unknown = 0, bad = 0;
+    int64_t nodes = 0;
+    for(int p = 0; p < positions; ++p){
+        const Board bd(randomBoard(rng, MAX_PLY / 4, MAX_PLY * 3 / 4));
+        const int exact = solvedValue(table, bd);
+        for(int k = exact - 1; k <= exact + 1; ++k){
+            Move move = MOVE_NONE;
+            const int result = solver.prove(bd, k, &move);
+            nodes += solver.nodes();
+            if(result < 0){ unknown += 1; continue; }
+            proofs += 1;
+            if(result != (exact >= k ? 1 : 0)){
+                bad += 1;
+                LOG_WARN("prove >= " << k << " : " << result << " but value is " << exact << endl << bd);
+            }else if(result == 1){
+                // 証明した手を指しても k 以上を保てること
+                Board nbd = bd;
+                if(move != MOVE_NONE){ nbd.move(move); }
+                const int value = solvedValue(table, nbd);
+                if(move == MOVE_NONE || (nbd.turnColor() == bd.turnColor() ? value : -value) < k){
+                    bad += 1;
+                    LOG_WARN("prove >= " << k << " : wrong move " << move << endl << bd);
+                }
+            }
+        }
+    }
+    LOG_INFO(positions << " positions proofs " << proofs << " unknown " << unknown
+             << " bad " << bad << " nodes " << nodes);
+    if(bad > 0){
+        cerr << "checkDfpn() : wrong proofs" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 分散探索の確認 (例 : 同じ計算機で worker -P 20001 & worker -P 20002 & を動かしておく)
+// 安全な手が尽きた局面をワーカーに分けて終局まで読ませ、1つのプロセスで読んだ結果と勝敗が一致するかを見る
+// 制限時間内に全ての手の値が揃わなければ失敗とする
+int checkCluster(const char *spec, int positions){
+    Cluster cluster;
+    if(cluster.connect(spec) == 0){
+        cerr << "checkCluster() : no workers" << endl;
+        return 1;
+    }
+    std::mt19937 rng(1);
+    SearchAgent *const pa[2] = {new SearchAgent(10000), new SearchAgent(10000)};
+    pa[0]->verbose = pa[1]->verbose = false;
+    pa[1]->setCluster(&cluster);
+    auto sign = [](Value v){ return (v > 0) - (v < 0); };
+    int same = 0, bad = 0;
+    for(int p = 0; p < positions; ++p){
+        const MiniBoard mbd = quietRandomBoard(rng);
+        std::tuple<Move, Value> result[2];
+        for(int i = 0; i < 2; ++i){
+            pa[i]->initialize();
+            result[i] = pa[i]->searchMove(mbd, MAX_PLY);
+        }
+        // 全ての root move の値が揃っていなければ比べられない
+        bool complete = cluster.alive() > 0;
+        for(const RootMove& rm : pa[1]->rootMoves){
+            complete = complete && -VALUE_INFINITE < rm.value && rm.value < VALUE_INFINITE;
+        }
+        if(complete && sign(std::get<1>(result[0])) == sign(std::get<1>(result[1]))){
+            same += 1;
+        }else{
+            bad += 1;
+            LOG_WARN("local " << std::get<0>(result[0]) << " " << std::get<1>(result[0])
+                     << " cluster " << std::get<0>(result[1]) << " " << std::get<1>(result[1])
+                     << (complete ? "" : " (incomplete)") << endl << mbd);
+        }
+    }
+    delete pa[0]; delete pa[1];
+    LOG_INFO(positions << " positions same result " << same << " different " << bad);
+    if(bad > 0){
+        cerr << "checkCluster() : results differ" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+// 置換表の衝突の確認 (TT_VERIFY を付けてビルドした場合のみ)
+// 序盤から中盤の局面を固定深さで読み、キーが一致したのに局面が違った回数を 100 万回の参照あたりで出す
+// 64bit のキーならほぼ 0 になるので、1 を越えれば失敗とする
+int checkCollisions(int positions, int depth){
+#ifndef TT_VERIFY
+    cerr << "checkCollisions() : build with TT_VERIFY (make TT_VERIFY=1)" << endl;
+    return 1;
+#else
+    std::mt19937 rng(1);
+    SearchAgent *const pa = new SearchAgent(1000000);
+    pa->verbose = false;
+    for(int p = 0; p < positions; ++p){
+        const MiniBoard mbd = randomBoard(rng, MAX_PLY / 5, MAX_PLY * 2 / 5);
+        pa->initialize();
+        pa->searchMove(mbd, depth);
+    }
+    // 参照と衝突の回数は表を消しても積算される
+    const int64_t probes = pa->tt.local_.probes_ + pa->tt.main_->probes_;
+    const double rate = pa->tt.collisionsPerMillion();
+    delete pa;
+    LOG_INFO(positions << " positions depth " << depth << " probes " << probes
+             << " collisions/Mprobe " << rate);
+    if(rate > 1.0){
+        cerr << "checkCollisions() : too many collisions" << endl;
+        return 1;
+    }
+    return 0;
+#endif
+}
 
 int main(int argc, char *argv[]){
     
-    using namespace DotsAndBoxes;
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-B")){ // 合法手生成の速度計測のみ
+            return benchmark();
+        }else if(!strcmp(argv[c], "-L")){ // 選択的探索の比較のみ (深さ 対局数 1手のノード数)
+            return compareSelective(c + 1 < argc ? atoi(argv[c + 1]) : 8,
+                                    c + 2 < argc ? atoi(argv[c + 2]) : 20,
+                                    c + 3 < argc ? atoll(argv[c + 3]) : 20000);
+        }else if(!strcmp(argv[c], "-G")){ // 探索量の回帰確認のみ (局面数 ノード数の上限)
+            return checkNodes(c + 1 < argc ? atoi(argv[c + 1]) : 10,
+                              c + 2 < argc ? atoll(argv[c + 2]) : 200000000);
+        }else if(!strcmp(argv[c], "-F")){ // 証明数探索を後退解析の表と比べるのみ (表 局面数)
+            return checkDfpn(c + 1 < argc ? argv[c + 1] : "solution.bin",
+                             c + 2 < argc ? atoi(argv[c + 2]) : 100);
+        }else if(!strcmp(argv[c], "-C")){ // 分散探索の確認のみ (host:port,... 局面数)
+            return checkCluster(c + 1 < argc ? argv[c + 1] : "localhost:20001",
+                                c + 2 < argc ? atoi(argv[c + 2]) : 10);
+        }else if(!strcmp(argv[c], "-T")){ // 置換表の衝突の確認のみ (局面数 深さ)
+            return checkCollisions(c + 1 < argc ? atoi(argv[c + 1]) : 6,
+                                   c + 2 < argc ? atoi(argv[c + 2]) : 8);
+        }else if(!strcmp(argv[c], "-U")){ // 評価関数の計算の確認のみ (重み)
+            return checkNNUE(c + 1 < argc && argv[c + 1][0] != '-' ? argv[c + 1] : nullptr, 2000);
+        }
+    }
     
     MiniBoard mbd;
     mbd.clear();
     
-    cerr << mbd << endl;
+    LOG_DEBUG(mbd);
     const int N = 100;
     
     SearchAgent *const pa0 = new SearchAgent(980);
     SearchAgent *const pa1 = new SearchAgent(980);
     
+    SolutionTable solution;
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-D")){ // 後退解析の結果
+            solution.open(argv[c + 1]);
+            pa1->setSolution(&solution);
+        }else if(!strcmp(argv[c], "-N")){ // 評価関数の重み
+            loadNNUE(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-E")){ // パターン評価の重み (ptlearn の出力)
+            loadPatterns(argv[c + 1]);
+        }
+    }
+    
+#ifdef USE_ANALYZER
+    // 探索統計の出力先
+    std::ofstream statsFile;
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-S")){
+            statsFile.open(argv[c + 1]);
+            pa0->statsStream = pa1->statsStream = &statsFile;
+        }
+    }
+#endif
+    
     int w[2] = {0};
     for(int n = 0; n < N; ++n){
         mbd.clear();
@@ -42,11 +473,10 @@ int main(int argc, char *argv[]){
             }
             Move move = std::get<0>(moveValue);
             mbd.move(move);
-            cerr << move << endl;
-            cerr << mbd << endl;
+            LOG_DEBUG(move << endl << mbd);
         }
         w[mbd.winner()] += 1;
-        cerr << w[0] << " - " << w[1] << endl;
+        LOG_INFO(w[0] << " - " << w[1]);
     }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,163 @@
+/*
+ datagen.cc
+ Katsuki Ohto
+ */
+
+// 自己対戦で学習データを作る
+// 例 : datagen -O data -G 1000000 -T 8 -L 20000
+// 同じ出力先を指定すれば続きから生成する
+// datagen -R data で読み込みの確認
+
+#include "dab.hpp"
+#include "agent.hpp"
+#include "datagen.hpp"
+
+using namespace DotsAndBoxes;
+
+// 探索の値を陣地差の単位に直す
+void setRecordValue(TrainingRecord *const precord, int value){
+    precord->flags = 0;
+    if(value <= -VALUE_INFINITE || value == VALUE_NONE){
+        precord->value = 0;
+        precord->flags |= RECORD_NO_VALUE;
+        return;
+    }
+    if(isMateValue(value)){
+        value = value > 0 ? value - VALUE_MATE : value + VALUE_MATE;
+        precord->flags |= RECORD_MATE;
+    }
+    precord->value = std::max(-SIZE, std::min(SIZE, value));
+}
+
+void selfPlay(SearchAgent *const pa, ShardWriter *const pwriter,
+              int64_t target, unsigned int seed, int cpu){
+    // 固定してから確保するので、自分の置換表は自分のノードのメモリに載る
+    pinThisThread(cpu);
+    std::mt19937 rng(seed);
+    Move buffer[MAX_MOVES];
+    while(pwriter->records() < target && !pwriter->failed()){
+        MiniBoard mbd;
+        mbd.clear();
+        // ランダムに線を引く
+        int numRandomLine = rng() % 8;
+        for(int i = 0; i < numRandomLine; ++i){
+            int moves = genAllMoves(buffer, mbd);
+            mbd.move(buffer[rng() % moves]);
+        }
+        pa->initialize();
+        
+        std::vector<TrainingRecord> game;
+        while(!mbd.filled()){
+            auto moveValue = pa->searchMove(mbd, MAX_PLY);
+            Color turnColor = mbd.turnColor();
+            int sign = (turnColor == B) ? 1 : -1;
+            TrainingRecord record;
+            record.lines = lineSetIndex(mbd);
+            setRecordValue(&record, std::get<1>(moveValue));
+            record.turnColor = turnColor;
+            record.areaDiff = sign * (mbd.area[B] - mbd.area[W]);
+            record.ply = mbd.ply;
+            game.push_back(record);
+            mbd.move(std::get<0>(moveValue));
+        }
+        for(TrainingRecord& record : game){
+            int sign = (record.turnColor == B) ? 1 : -1;
+            record.result = sign * (mbd.area[B] - mbd.area[W]);
+        }
+        pwriter->push(std::move(game));
+    }
+}
+
+int generate(const std::string& dir, int64_t target, int threads, int64_t nodeLimit, int localDepth,
+             PinPolicy pinPolicy){
+    const NumaTopology topo;
+    cerr << "topology : " << topo.toString() << endl;
+    mkdir(dir.c_str(), 0755);
+    ShardWriter writer(dir);
+    std::vector<SearchAgent*> agents;
+    std::vector<std::thread> workers;
+    // localDepth を指定した場合は深い局面の置換表を全スレッドで共有する
+    std::unique_ptr<HashTable> shared;
+    if(localDepth > 0){
+        shared.reset(new HashTable(HashTable::DEFAULT_SIZE, true));
+        if(shared->interleave(topo)){
+            cerr << "shared table interleaved over " << topo.nodes() << " nodes" << endl;
+        }
+    }
+    for(int t = 0; t < threads; ++t){
+        SearchAgent *const pa = new SearchAgent(1000000);
+        pa->setNodeLimit(nodeLimit);
+        pa->setSharedTable(shared.get());
+        pa->setLocalDepth(localDepth);
+        pa->verbose = false;
+        agents.push_back(pa);
+    }
+    ClockMicS clock;
+    clock.start();
+    for(int t = 0; t < threads; ++t){
+        const int cpu = cpuForThread(topo, pinPolicy, t);
+        if(cpu >= 0){ cerr << "thread " << t << " -> cpu " << cpu << endl; }
+        workers.emplace_back(selfPlay, agents[t], &writer, target, (unsigned int)dice(), cpu);
+    }
+    int64_t last = -1;
+    while(writer.records() < target && !writer.failed()){
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        if(writer.records() != last){
+            last = writer.records();
+            cerr << "records " << last << " / " << target;
+            cerr << " time " << clock.stop() / 1000000 << " sec" << endl;
+        }
+    }
+    for(auto& th : workers){ th.join(); }
+    writer.close();
+    for(auto pa : agents){ delete pa; }
+    return writer.failed() ? -1 : 0;
+}
+
+int readShards(const std::string& dir){
+    ShardReader reader(dir, 1 << 20, dice());
+    TrainingRecord record;
+    int64_t n = 0, wins = 0;
+    while(reader.next(&record)){
+        n += 1;
+        if(record.result > 0){ wins += 1; }
+    }
+    cerr << n << " records, win rate of side to move " << (n ? wins / (double)n : 0.0) << endl;
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    std::string dir = "data";
+    int64_t target = 100000;
+    int threads = N_THREADS;
+    int64_t nodeLimit = 20000;
+    int localDepth = 0;
+    PinPolicy pinPolicy = PIN_NONE;
+    bool readMode = false;
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-O")){
+            dir = std::string(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-G")){ // 生成するレコード数
+            target = atoll(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-T")){
+            threads = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-L")){ // 1手あたりの探索ノード数
+            nodeLimit = atoll(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-H")){ // 置換表を共有し、この深さ未満はスレッドごとの表に置く
+            localDepth = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-A")){ // スレッドの CPU への固定 (none, compact, spread)
+            pinPolicy = string2PinPolicy(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-N")){ // 評価関数の重み
+            loadNNUE(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-E")){ // パターン評価の重み (ptlearn の出力)
+            loadPatterns(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-R")){
+            readMode = true;
+            dir = std::string(argv[c + 1]);
+        }
+    }
+    if(readMode){
+        return readShards(dir);
+    }
+    return generate(dir, target, threads, nodeLimit, localDepth, pinPolicy);
+}
\ No newline at end of file
@@ -0,0 +1,236 @@
+/*
+ datagen.hpp
+ Katsuki Ohto
+ */
+
+#ifndef DAB_DATAGEN_HPP_
+#define DAB_DATAGEN_HPP_
+
+#include "dab.hpp"
+#include "retrograde.hpp"
+
+namespace DotsAndBoxes{
+    
+    /**************************学習データ**************************/
+    
+    // 値は全て手番側から見たもの
+    // value は終局時の陣地差の予測で [-SIZE, SIZE] に収まる
+    // 詰みを読み切った値は保証された陣地差 (勝ちなら下界、負けなら上界) に直して RECORD_MATE を立てる
+    // 最初の反復の前に探索が止まった場合は 0 として RECORD_NO_VALUE を立てる
+    enum RecordFlag : int16_t{
+        RECORD_MATE = 1,
+        RECORD_NO_VALUE = 2,
+    };
+    
+    struct TrainingRecord{
+        uint64_t lines; // 引かれた線の集合 (lineSetIndex)
+        int16_t value; // 探索の評価値
+        int8_t turnColor;
+        int8_t areaDiff; // その時点での陣地差
+        int8_t result; // 終局時の陣地差
+        int8_t ply;
+        int16_t flags; // RecordFlag の和
+    };
+    static_assert(sizeof(TrainingRecord) == 16, "TrainingRecord must be 16 bytes");
+    
+    // 1ファイル (shard) に最大 RECORDS_PER_SHARD 個のレコードを持つ
+    // 生成を終える度にその回の最後の shard は途中で終わり、再開した生成はその後に新しい shard を足す
+    // そのため途中で終わった shard は最後の1つとは限らず、件数は各 shard のヘッダを見る
+    struct ShardHeader{
+        char magic[8];
+        int32_t lx, ly;
+        int32_t count;
+        int32_t reserved;
+    };
+    constexpr char SHARD_MAGIC[8] = {'D', 'A', 'B', 'S', 'H', 'R', 'D', '1'};
+    constexpr int RECORDS_PER_SHARD = 1 << 16;
+    
+    std::string shardPath(const std::string& dir, int index){
+        char name[32];
+        snprintf(name, sizeof(name), "shard_%06d.bin", index);
+        return dir + "/" + name;
+    }
+    
+    // 読めなければ -1
+    int readShardHeader(const std::string& path, ShardHeader *const pheader){
+        std::ifstream ifs(path, std::ios::binary);
+        if(!ifs){ return -1; }
+        ifs.read(reinterpret_cast<char*>(pheader), sizeof(ShardHeader));
+        if(!ifs || memcmp(pheader->magic, SHARD_MAGIC, sizeof(SHARD_MAGIC))
+           || pheader->lx != LENGTH_X || pheader->ly != LENGTH_Y){
+            return -1;
+        }
+        return pheader->count;
+    }
+    
+    /**************************書き込み**************************/
+    
+    // 書き込みは専用のスレッドで行い、対局スレッドは待たない
+    struct ShardWriter{
+        std::string dir_;
+        int nextShard_;
+        std::atomic<int64_t> records_; // 受け取ったレコード数 (再開前の分を含む)
+        std::vector<TrainingRecord> buffer_;
+        std::queue<std::vector<TrainingRecord>> queue_;
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        bool closing_;
+        std::atomic<bool> failed_; // 書き込みに失敗したら以降は何も書かない
+        std::thread thread_;
+        
+        // 既にある shard の続きから書く
+        ShardWriter(const std::string& dir):
+        dir_(dir), nextShard_(0), records_(0), closing_(false), failed_(false){
+            ShardHeader header;
+            int count;
+            while((count = readShardHeader(shardPath(dir_, nextShard_), &header)) >= 0){
+                records_ += count;
+                nextShard_ += 1;
+            }
+            if(nextShard_ > 0){
+                cerr << "ShardWriter : resume from shard " << nextShard_;
+                cerr << " (" << records_ << " records)" << endl;
+            }
+            buffer_.reserve(RECORDS_PER_SHARD);
+            thread_ = std::thread(&ShardWriter::run, this);
+        }
+        ~ShardWriter(){ close(); }
+        
+        int64_t records()const noexcept{ return records_; }
+        bool failed()const noexcept{ return failed_; }
+        
+        void push(std::vector<TrainingRecord>&& game){
+            records_ += game.size();
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queue_.push(std::move(game));
+            }
+            cv_.notify_one();
+        }
+        // 残りを書き出して終了
+        void close(){
+            if(!thread_.joinable()){ return; }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closing_ = true;
+            }
+            cv_.notify_one();
+            thread_.join();
+        }
+        
+        void run(){
+            while(true){
+                std::vector<TrainingRecord> game;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this]{ return closing_ || !queue_.empty(); });
+                    if(queue_.empty()){ break; } // closing
+                    game = std::move(queue_.front());
+                    queue_.pop();
+                }
+                if(failed_){ continue; } // 残りは捨てて終了を待つ
+                for(const TrainingRecord& record : game){
+                    buffer_.push_back(record);
+                    if((int)buffer_.size() >= RECORDS_PER_SHARD){ flush(); }
+                }
+            }
+            flush();
+        }
+        void flush(){
+            if(buffer_.empty() || failed_){ return; }
+            ShardHeader header;
+            memcpy(header.magic, SHARD_MAGIC, sizeof(SHARD_MAGIC));
+            header.lx = LENGTH_X; header.ly = LENGTH_Y;
+            header.count = buffer_.size();
+            header.reserved = 0;
+            // 書き終えてから名前を変えるので、中断しても壊れた shard は残らない
+            const std::string path = shardPath(dir_, nextShard_);
+            const std::string tmpPath = path + ".tmp";
+            {
+                std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+                ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                ofs.write(reinterpret_cast<const char*>(buffer_.data()),
+                          buffer_.size() * sizeof(TrainingRecord));
+                if(!ofs){
+                    cerr << "ShardWriter : failed to write " << tmpPath << endl;
+                    fail();
+                    return;
+                }
+            }
+            if(rename(tmpPath.c_str(), path.c_str()) != 0){
+                cerr << "ShardWriter : failed to rename " << tmpPath << endl;
+                fail();
+                return;
+            }
+            nextShard_ += 1;
+            buffer_.clear();
+        }
+        // 同じ失敗を繰り返さないよう、溜めた分を捨てて生成を止めさせる
+        void fail(){
+            cerr << "ShardWriter : stop generation, " << buffer_.size() << " records are lost" << endl;
+            buffer_.clear();
+            buffer_.shrink_to_fit();
+            failed_ = true;
+        }
+    };
+    
+    /**************************読み込み**************************/
+    
+    // 全 shard から少しずつ読んで、一定サイズのバッファの中でシャッフルする
+    // 全データをメモリに載せる必要はない
+    struct ShardReader{
+        static constexpr int CHUNK = 256; // 1度に読むレコード数
+        struct Source{
+            std::string path;
+            int read, count;
+        };
+        std::vector<Source> sources_; // まだ読み終えていない shard
+        std::vector<TrainingRecord> buffer_;
+        size_t bufferSize_;
+        std::mt19937 dice_;
+        
+        ShardReader(const std::string& dir, size_t bufferSize, unsigned int seed):
+        bufferSize_(bufferSize), dice_(seed){
+            ShardHeader header;
+            int count;
+            for(int i = 0; (count = readShardHeader(shardPath(dir, i), &header)) >= 0; ++i){
+                if(count > 0){ sources_.push_back({shardPath(dir, i), 0, count}); }
+            }
+            buffer_.reserve(bufferSize_ + CHUNK);
+        }
+        
+        bool next(TrainingRecord *const precord){
+            while(buffer_.size() < bufferSize_ && !sources_.empty()){
+                fill();
+            }
+            if(buffer_.empty()){ return false; }
+            size_t i = dice_() % buffer_.size();
+            *precord = buffer_[i];
+            buffer_[i] = buffer_.back();
+            buffer_.pop_back();
+            return true;
+        }
+        void fill(){ // ランダムに選んだ shard の続きを読む
+            size_t s = dice_() % sources_.size();
+            Source& src = sources_[s];
+            int n = std::min(int(CHUNK), src.count - src.read); // 参照で渡すと -O0 でリンクできない
+            std::ifstream ifs(src.path, std::ios::binary);
+            ifs.seekg(sizeof(ShardHeader) + src.read * sizeof(TrainingRecord));
+            size_t base = buffer_.size();
+            buffer_.resize(base + n);
+            ifs.read(reinterpret_cast<char*>(buffer_.data() + base), n * sizeof(TrainingRecord));
+            if(!ifs){
+                cerr << "ShardReader : failed to read " << src.path << endl;
+                buffer_.resize(base);
+                n = src.count - src.read; // この shard は諦める
+            }
+            src.read += n;
+            if(src.read >= src.count){
+                sources_[s] = sources_.back();
+                sources_.pop_back();
+            }
+        }
+    };
+}
+
+#endif // DAB_DATAGEN_HPP_
\ No newline at end of file
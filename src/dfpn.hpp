@@ -0,0 +1,248 @@
+/*
+ dfpn.hpp
+ Katsuki Ohto
+ */
+
+#ifndef DAB_DFPN_HPP_
+#define DAB_DFPN_HPP_
+
+#include "dab.hpp"
+
+namespace DotsAndBoxes{
+    
+    /**************************証明数探索**************************/
+    
+    // 各局面を「手番側が残りのマスで t 以上の差を付けられるか」という問いとして扱う
+    // 取った場合は手番が変わらないので問いは (t - 取った数) のまま続き、
+    // 取らなかった場合は相手の問い (1 - t) の否定になる
+    // 問いは線の配置と t だけで決まるので置換表のキーもそれで作る
+    
+    constexpr uint32_t DFPN_INFINITE = 0x7FFFFFFF;
+    
+    // 線の配置のキーと t から作る (上位と下位を別々に使うのでよく混ぜる)
+    uint64_t dfpnKey(uint64_t lineKey, int t)noexcept{
+        uint64_t key = lineKey ^ (uint64_t(t + 128) * 0x9E3779B97F4A7C15ULL);
+        key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+        return key ^ (key >> 31);
+    }
+    uint32_t dfpnAdd(uint32_t a, uint32_t b)noexcept{
+        if(a >= DFPN_INFINITE || b >= DFPN_INFINITE){ return DFPN_INFINITE; }
+        return uint32_t(std::min(uint64_t(DFPN_INFINITE - 1), uint64_t(a) + b));
+    }
+    
+    struct DfpnEntry{
+        uint32_t check; // キーの上位32bit
+        uint32_t work; // この局面以下で使ったノード数 (置き換えの優先度)
+        uint32_t pn, dn;
+    };
+    static_assert(sizeof(DfpnEntry) == 16, "DfpnEntry must be 16 bytes");
+    
+    // 4エントリで1キャッシュライン
+    struct DfpnTable{
+        static constexpr int WAYS = 4;
+        std::vector<DfpnEntry> entries_;
+        uint64_t mask_; // バケット数 - 1
+        
+        // bytes 以下で最大の2のべき乗の大きさにする
+        DfpnTable(size_t bytes){
+            size_t buckets = 1;
+            while(buckets * 2 * WAYS * sizeof(DfpnEntry) <= bytes){ buckets *= 2; }
+            entries_.resize(buckets * WAYS);
+            mask_ = buckets - 1;
+            clear();
+        }
+        void clear(){
+            std::fill(entries_.begin(), entries_.end(), DfpnEntry{0, 0, 0, 0});
+        }
+        size_t bytes()const noexcept{ return entries_.size() * sizeof(DfpnEntry); }
+        
+        DfpnEntry *bucket(uint64_t key)noexcept{
+            return &entries_[(key & mask_) * WAYS];
+        }
+        // 見つからなければ初期値のまま
+        void probe(uint64_t key, uint32_t *const ppn, uint32_t *const pdn)noexcept{
+            const DfpnEntry *const b = bucket(key);
+            const uint32_t check = uint32_t(key >> 32);
+            for(int i = 0; i < WAYS; ++i){
+                if(b[i].check == check && b[i].work){
+                    *ppn = b[i].pn; *pdn = b[i].dn;
+                    return;
+                }
+            }
+        }
+        void store(uint64_t key, uint32_t pn, uint32_t dn, uint32_t work)noexcept{
+            DfpnEntry *const b = bucket(key);
+            const uint32_t check = uint32_t(key >> 32);
+            DfpnEntry *replaced = b;
+            for(int i = 0; i < WAYS; ++i){
+                if(b[i].check == check && b[i].work){
+                    replaced = b + i;
+                    break;
+                }
+                if(b[i].work < replaced->work){ replaced = b + i; }
+            }
+            *replaced = DfpnEntry{check, std::max(work, 1U), pn, dn};
+        }
+    };
+    
+    struct DfpnSolver{
+        DfpnTable tt_;
+        int64_t nodes_;
+        int64_t nodeLimit_;
+        std::atomic<bool> stop_;
+        bool aborted_;
+        
+        // バックグラウンドで解く場合
+        std::thread thread_;
+        std::atomic<bool> done_;
+        int result_;
+        Move move_;
+        
+        DfpnSolver(size_t bytes, int64_t nodeLimit = -1):
+        tt_(bytes), nodes_(0), nodeLimit_(nodeLimit), stop_(false), aborted_(false),
+        done_(false), result_(-1), move_(MOVE_NONE){}
+        ~DfpnSolver(){ stop(); }
+        
+        int64_t nodes()const noexcept{ return nodes_; }
+        void setNodeLimit(int64_t limit)noexcept{ nodeLimit_ = limit; }
+        
+        // 手番側の終局時の陣地差が k 以上かを証明する
+        // 戻り値 1 : k 以上 (*pmove に証明した手、終局していれば MOVE_NONE), 0 : k 未満, -1 : 打ち切り
+        template<class oboard_t>
+        int prove(const oboard_t& obd, int k, Move *const pmove = nullptr){
+            Board bd = obd;
+            nodes_ = 0;
+            aborted_ = false;
+            const int t = k - bd.areaDiff(bd.turnColor());
+            const uint64_t key = dfpnKey(bd.key(), t);
+            Move move = MOVE_NONE;
+            uint32_t pn = 1, dn = 1;
+            while(!aborted_){
+                mid(bd, t, key, DFPN_INFINITE, DFPN_INFINITE, &move);
+                pn = dn = 1;
+                tt_.probe(key, &pn, &dn);
+                if(pn == 0 || dn == 0){ break; }
+            }
+            if(aborted_){ return -1; }
+            if(pn == 0 && pmove != nullptr){ *pmove = move; }
+            return pn == 0 ? 1 : 0;
+        }
+        
+        // 別スレッドで prove() を始める
+        template<class oboard_t>
+        void start(const oboard_t& obd, int k){
+            stop();
+            stop_ = false;
+            done_ = false;
+            result_ = -1;
+            move_ = MOVE_NONE;
+            const Board bd = obd;
+            thread_ = std::thread([this, bd, k](){
+                result_ = prove(bd, k, &move_);
+                done_ = true;
+            });
+        }
+        bool done()const noexcept{ return done_; }
+        int result()const noexcept{ return result_; }
+        Move move()const noexcept{ return move_; }
+        // 打ち切って終了を待つ
+        void stop(){
+            stop_ = true;
+            if(thread_.joinable()){ thread_.join(); }
+        }
+        
+        struct Child{
+            Move move;
+            uint64_t key;
+            int t;
+            bool same; // 取ったので手番が変わらない
+            uint32_t initialPN, initialDN;
+        };
+        
+        void mid(Board& bd, int t, uint64_t key,
+                 uint32_t thpn, uint32_t thdn, Move *const pbest = nullptr){
+            nodes_ += 1;
+            if(stop_ || (nodeLimit_ >= 0 && nodes_ > nodeLimit_)){
+                aborted_ = true;
+                return;
+            }
+            // 残りを全部取っても足りない、全部取られても足りる
+            const int rest = SIZE - int(bd.area[B] + bd.area[W]);
+            if(t <= -rest){
+                tt_.store(key, 0, DFPN_INFINITE, 1);
+                if(pbest != nullptr){ // どの手でも足りるので合法手を1つ返す
+                    Move buffer[MAX_MOVES];
+                    if(genAllMoves(buffer, bd) > 0){ *pbest = buffer[0]; }
+                }
+                return;
+            }
+            if(t > rest){ tt_.store(key, DFPN_INFINITE, 0, 1); return; }
+            
+            const int64_t nodes0 = nodes_;
+            Move buffer[MAX_MOVES];
+            Child children[MAX_MOVES];
+            const int numMoves = genAllMoves(buffer, bd);
+            for(int i = 0; i < numMoves; ++i){
+                Child& c = children[i];
+                c.move = buffer[i];
+                const int newArea = bd.move(c.move);
+                c.same = newArea > 0;
+                c.t = c.same ? (t - newArea) : (1 - t);
+                c.key = dfpnKey(bd.key(), c.t);
+                const int crest = rest - newArea;
+                if(c.t <= -crest){
+                    c.initialPN = 0; c.initialDN = DFPN_INFINITE;
+                }else if(c.t > crest){
+                    c.initialPN = DFPN_INFINITE; c.initialDN = 0;
+                }else{
+                    // 相手に取らせる手は後回し
+                    c.initialPN = 1;
+                    c.initialDN = (!c.same && bd.numReaches > 0) ? 2 : 1;
+                }
+                bd.unmove(c.move);
+            }
+            
+            while(true){
+                uint32_t pn = DFPN_INFINITE, dn = 0;
+                uint32_t phi2 = DFPN_INFINITE, bestDelta = 0;
+                int best = -1;
+                for(int i = 0; i < numMoves; ++i){
+                    const Child& c = children[i];
+                    uint32_t cpn = c.initialPN, cdn = c.initialDN;
+                    tt_.probe(c.key, &cpn, &cdn);
+                    const uint32_t phi = c.same ? cpn : cdn;
+                    const uint32_t delta = c.same ? cdn : cpn;
+                    dn = dfpnAdd(dn, delta);
+                    if(phi < pn){
+                        phi2 = pn;
+                        pn = phi;
+                        best = i;
+                        bestDelta = delta;
+                    }else if(phi < phi2){
+                        phi2 = phi;
+                    }
+                }
+                tt_.store(key, pn, dn, uint32_t(std::min(nodes_ - nodes0 + 1, int64_t(UINT32_MAX))));
+                if(pn == 0 && pbest != nullptr){ *pbest = children[best].move; }
+                if(pn >= thpn || dn >= thdn || aborted_){ break; }
+                
+                // 2番目に良い手を越えるか、全体の反証数の閾値に達するまで最善の子を読む
+                // 閾値を少し広げて兄弟間の行き来を減らす (1 + epsilon trick)
+                const uint32_t thPhi = std::min(thpn, dfpnAdd(phi2, phi2 / 4 + 1));
+                const uint32_t thDelta = uint32_t(std::min(int64_t(DFPN_INFINITE),
+                                                           int64_t(thdn) - dn + bestDelta));
+                const Child& c = children[best];
+                bd.move(c.move);
+                if(c.same){
+                    mid(bd, c.t, c.key, thPhi, thDelta);
+                }else{
+                    mid(bd, c.t, c.key, thDelta, thPhi);
+                }
+                bd.unmove(c.move);
+            }
+        }
+    };
+}
+
+#endif // DAB_DFPN_HPP_
\ No newline at end of file
@@ -0,0 +1,254 @@
+/*
+ log.hpp
+ Katsuki Ohto
+ */
+
+#ifndef DAB_LOG_HPP_
+#define DAB_LOG_HPP_
+
+#include <cstring>
+#include <iostream>
+#include <streambuf>
+#include <ostream>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <array>
+
+// 水準ごとの出力
+// LOG_LEVEL 未満の水準の LOG_* は式ごと消えるので、引数の整形も行われない
+// 有効な水準の出力はリングバッファに積み、専用スレッドが書き出す
+// 例 : LOG_INFO("depth " << depth << " value " << value);
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+
+#ifndef LOG_LEVEL
+#if defined(MATCH)
+#define LOG_LEVEL LOG_LEVEL_WARN
+#elif defined(DEBUG)
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#else
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+// 出力の前に重い準備が要る場合に if の条件に使う
+#define LOG_ENABLED(level) ((level) >= LOG_LEVEL)
+
+#define LOG_WRITE(level, message) do{\
+DotsAndBoxes::LogLine line_(level); line_.stream() << message;\
+}while(0)
+
+#if LOG_LEVEL <= LOG_LEVEL_TRACE
+#define LOG_TRACE(message) LOG_WRITE(LOG_LEVEL_TRACE, message)
+#else
+#define LOG_TRACE(message) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(message) LOG_WRITE(LOG_LEVEL_DEBUG, message)
+#else
+#define LOG_DEBUG(message) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(message) LOG_WRITE(LOG_LEVEL_INFO, message)
+#else
+#define LOG_INFO(message) ((void)0)
+#endif
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(message) LOG_WRITE(LOG_LEVEL_WARN, message)
+#else
+#define LOG_WARN(message) ((void)0)
+#endif
+#define LOG_ERROR(message) LOG_WRITE(LOG_LEVEL_ERROR, message)
+
+namespace DotsAndBoxes{
+    
+    /**************************リングバッファ**************************/
+    
+    // 複数スレッドが書き、書き出しスレッド1つが読む
+    // 各枠の sequence で書き込み済みかどうかを判定するのでロックは使わない
+    struct LogSlot{
+        static constexpr int TEXT = 4096 - 16;
+        std::atomic<uint64_t> sequence;
+        int32_t length;
+        int32_t level;
+        char text[TEXT];
+    };
+    
+    struct LogRing{
+        static constexpr uint64_t SLOTS = 512; // 2のべき乗
+        std::array<LogSlot, SLOTS> slots_;
+        std::atomic<uint64_t> head_; // 次に書く位置
+        std::atomic<uint64_t> tail_; // 次に読む位置
+        std::atomic<uint64_t> dropped_; // 満杯で捨てた数
+        
+        LogRing():
+        head_(0), tail_(0), dropped_(0){
+            for(uint64_t i = 0; i < SLOTS; ++i){
+                slots_[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+        
+        // 満杯なら待たずに捨てる
+        bool push(int level, const char *text, size_t length)noexcept{
+            uint64_t pos = head_.load(std::memory_order_relaxed);
+            while(true){
+                LogSlot& slot = slots_[pos & (SLOTS - 1)];
+                const uint64_t seq = slot.sequence.load(std::memory_order_acquire);
+                const int64_t diff = int64_t(seq) - int64_t(pos);
+                if(diff == 0){
+                    if(head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                        slot.level = level;
+                        slot.length = int32_t(std::min(length, size_t(LogSlot::TEXT)));
+                        memcpy(slot.text, text, slot.length);
+                        slot.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }else if(diff < 0){
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }else{
+                    pos = head_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+        // 書き出しスレッドのみが呼ぶ
+        template<class callback_t>
+        bool pop(const callback_t& callback){
+            const uint64_t pos = tail_.load(std::memory_order_relaxed);
+            LogSlot& slot = slots_[pos & (SLOTS - 1)];
+            if(slot.sequence.load(std::memory_order_acquire) != pos + 1){ return false; }
+            callback(slot);
+            slot.sequence.store(pos + SLOTS, std::memory_order_release);
+            tail_.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+    };
+    
+    /**************************書き出し**************************/
+    
+    struct Logger{
+        LogRing ring_;
+        std::ostream *sink_;
+        std::atomic<bool> running_;
+        std::thread thread_;
+        
+        Logger():
+        sink_(&std::cerr), running_(true){
+            thread_ = std::thread(&Logger::run, this);
+        }
+        ~Logger(){
+            running_ = false;
+            if(thread_.joinable()){ thread_.join(); }
+        }
+        
+        // 書き出し先の変更は出力が無い間に行う
+        void setSink(std::ostream *sink){
+            flush();
+            sink_ = sink;
+        }
+        void push(int level, const char *text, size_t length)noexcept{
+            ring_.push(level, text, length);
+        }
+        // ここまでに積まれた分が書き出されるまで待つ
+        void flush(){
+            const uint64_t head = ring_.head_.load(std::memory_order_acquire);
+            while(ring_.tail_.load(std::memory_order_acquire) < head){
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            sink_->flush();
+        }
+        
+        void run(){
+            auto write = [this](const LogSlot& slot){
+                sink_->write(slot.text, slot.length);
+            };
+            uint64_t dropped = 0;
+            while(true){
+                bool any = false;
+                while(ring_.pop(write)){ any = true; }
+                const uint64_t d = ring_.dropped_.load(std::memory_order_relaxed);
+                if(d != dropped){
+                    *sink_ << "(log : dropped " << (d - dropped) << " messages)" << std::endl;
+                    dropped = d;
+                }
+                if(any){
+                    sink_->flush();
+                }else if(!running_){
+                    break;
+                }else{
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+        }
+    };
+    
+    Logger logger;
+    
+    /**************************整形**************************/
+    
+    // スレッドごとの固定長バッファに整形する (長すぎる分は切り捨て)
+    struct LogStreamBuffer : std::streambuf{
+        char buffer_[LogSlot::TEXT];
+        LogStreamBuffer(){ reset(); }
+        void reset()noexcept{ setp(buffer_, buffer_ + sizeof(buffer_)); }
+        const char *data()const noexcept{ return pbase(); }
+        size_t size()const noexcept{ return pptr() - pbase(); }
+    };
+    
+    struct LogStream{
+        LogStreamBuffer buffer_;
+        std::ostream stream_;
+        LogStream(): stream_(&buffer_){}
+    };
+    
+    // 1回の LOG_* の出力 (行末の改行は自動で付ける)
+    struct LogLine{
+        int level_;
+        LogStream& ls_;
+        
+        static LogStream& threadStream(){
+            thread_local LogStream ls;
+            return ls;
+        }
+        LogLine(int level):
+        level_(level), ls_(threadStream()){
+            ls_.buffer_.reset();
+            ls_.stream_.clear();
+        }
+        ~LogLine(){
+            ls_.stream_ << '\n';
+            size_t size = ls_.buffer_.size();
+            if(ls_.stream_.bad() && size > 0){ ls_.buffer_.buffer_[size - 1] = '\n'; } // 切り捨て
+            logger.push(level_, ls_.buffer_.data(), size);
+        }
+        std::ostream& stream()noexcept{ return ls_.stream_; }
+    };
+    
+    /**************************頻度制限**************************/
+    
+    // 探索の経過など頻繁に出る出力を一定間隔に間引く
+    struct LogRateLimiter{
+        std::chrono::steady_clock::duration interval_;
+        std::chrono::steady_clock::time_point last_;
+        
+        LogRateLimiter(int intervalMs):
+        interval_(std::chrono::milliseconds(intervalMs)), last_(){}
+        
+        void reset()noexcept{ last_ = std::chrono::steady_clock::time_point(); }
+        bool allow()noexcept{
+            const auto now = std::chrono::steady_clock::now();
+            if(last_ != std::chrono::steady_clock::time_point() && now - last_ < interval_){
+                return false;
+            }
+            last_ = now;
+            return true;
+        }
+    };
+}
+
+#endif // DAB_LOG_HPP_
\ No newline at end of file
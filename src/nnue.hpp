@@ -0,0 +1,200 @@
+/*
+ nnue.hpp
+ Katsuki Ohto
+ */
+
+#ifndef DAB_NNUE_HPP_
+#define DAB_NNUE_HPP_
+
+#include "dab.hpp"
+
+namespace DotsAndBoxes{
+    
+    /**************************評価関数**************************/
+    
+    // 入力 (線) -> 64 (int16, 盤面で差分計算) -> 32 (int8) -> 1
+    // 出力は手番側から見た残りのマスの得点差の予測
+    constexpr int NN_L2 = 32;
+    constexpr int NN_SHIFT = 6; // 中間層の固定小数点の桁
+    
+    struct NNNetwork{
+        int32_t l2Bias[NN_L2];
+        int8_t l2Weight[NN_L2][NN_HIDDEN];
+        int32_t outBias;
+        int8_t outWeight[NN_L2];
+        int32_t outputScale; // 出力 / outputScale がマス数
+    };
+    alignas(32) NNNetwork nnNetwork;
+    
+    // SIMD を使わない版 (AVX2 の無い環境用、dab_test -U で AVX2 版と比べる)
+    void nnClippedReLUScalar(const int16_t *in, uint8_t *out)noexcept{
+        for(int i = 0; i < NN_HIDDEN; ++i){
+            out[i] = uint8_t(std::max(0, std::min(127, int(in[i]))));
+        }
+    }
+    int32_t nnDotScalar(const uint8_t *in, const int8_t *w, int n)noexcept{
+        int32_t sum = 0;
+        for(int i = 0; i < n; ++i){
+            sum += int32_t(in[i]) * int32_t(w[i]);
+        }
+        return sum;
+    }
+    
+    // int16 の値を [0, 127] に切って詰める
+    void nnClippedReLU(const int16_t *in, uint8_t *out)noexcept{
+#ifdef __AVX2__
+        const __m256i zero = _mm256_setzero_si256();
+        for(int i = 0; i < NN_HIDDEN; i += 32){
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16));
+            __m256i p = _mm256_max_epi8(_mm256_packs_epi16(a, b), zero);
+            p = _mm256_permute4x64_epi64(p, 0xD8); // packs のレーン順を戻す
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), p);
+        }
+#else
+        nnClippedReLUScalar(in, out);
+#endif
+    }
+    
+    // uint8 x int8 の内積 (n は 32 の倍数)
+    int32_t nnDot(const uint8_t *in, const int8_t *w, int n)noexcept{
+#ifdef __AVX2__
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i sum = _mm256_setzero_si256();
+        for(int i = 0; i < n; i += 32){
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), ones));
+        }
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        return _mm_cvtsi128_si32(s);
+#else
+        return nnDotScalar(in, w, n);
+#endif
+    }
+    
+    template<bool SIMD = true>
+    int nnForward(const NNAccumulator& acc)noexcept{
+        alignas(32) uint8_t h1[NN_HIDDEN];
+        alignas(32) uint8_t h2[NN_L2];
+        if(SIMD){ nnClippedReLU(acc.v, h1); }else{ nnClippedReLUScalar(acc.v, h1); }
+        for(int j = 0; j < NN_L2; ++j){
+            const int32_t dot = SIMD ? nnDot(h1, nnNetwork.l2Weight[j], NN_HIDDEN)
+                                     : nnDotScalar(h1, nnNetwork.l2Weight[j], NN_HIDDEN);
+            int32_t x = (nnNetwork.l2Bias[j] + dot) >> NN_SHIFT;
+            h2[j] = uint8_t(std::max(0, std::min(127, x)));
+        }
+        int32_t out = nnNetwork.outBias + (SIMD ? nnDot(h2, nnNetwork.outWeight, NN_L2)
+                                                : nnDotScalar(h2, nnNetwork.outWeight, NN_L2));
+        // 四捨五入してマス単位に
+        return (out >= 0 ? out + nnNetwork.outputScale / 2 : out - nnNetwork.outputScale / 2)
+               / nnNetwork.outputScale;
+    }
+    
+    // パターンの重みの和をマス単位に
+    int ptForward(const PatternAccumulator& pattern)noexcept{
+        const int32_t sum = pattern.sum;
+        return (sum >= 0 ? sum + PT_SCALE / 2 : sum - PT_SCALE / 2) / PT_SCALE;
+    }
+    
+    // NNUE、パターンの順に重みがある方を使う
+    // どちらも無ければ確定した陣地の差のみ
+    template<class board_t>
+    int evaluate(const board_t& bd)noexcept{
+        const int diff = bd.areaDiff(bd.turnColor());
+        if(!nnLoaded && !ptLoaded){ return diff; }
+        const int rest = SIZE - int(bd.area[B] + bd.area[W]);
+        const int predicted = nnLoaded ? nnForward(bd.accumulator) : ptForward(bd.pattern);
+        return diff + std::max(-rest, std::min(rest, predicted));
+    }
+    
+    /**************************重みの読み込み**************************/
+    
+    // 形式 : "DABNNUE1", int32 入力数, 中間層1, 中間層2, 出力の尺度,
+    //        int16 入力層 bias[64], weight[入力数][64],
+    //        int32 bias[32], int8 weight[32][64], int32 bias, int8 weight[32]
+    bool loadNNUE(const std::string& path){
+        nnLoaded = false;
+        std::ifstream ifs(path, std::ios::binary);
+        if(!ifs){
+            cerr << "loadNNUE() : failed to open " << path << endl;
+            return false;
+        }
+        char magic[8];
+        int32_t dims[4];
+        ifs.read(magic, sizeof(magic));
+        ifs.read(reinterpret_cast<char*>(dims), sizeof(dims));
+        if(!ifs || memcmp(magic, "DABNNUE1", 8)
+           || dims[0] != NN_FEATURES || dims[1] != NN_HIDDEN || dims[2] != NN_L2 || dims[3] <= 0){
+            cerr << "loadNNUE() : unsupported file " << path << endl;
+            return false;
+        }
+        nnNetwork.outputScale = dims[3];
+        ifs.read(reinterpret_cast<char*>(nnFeature.bias), sizeof(nnFeature.bias));
+        ifs.read(reinterpret_cast<char*>(nnFeature.weight), sizeof(nnFeature.weight));
+        ifs.read(reinterpret_cast<char*>(nnNetwork.l2Bias), sizeof(nnNetwork.l2Bias));
+        ifs.read(reinterpret_cast<char*>(nnNetwork.l2Weight), sizeof(nnNetwork.l2Weight));
+        ifs.read(reinterpret_cast<char*>(&nnNetwork.outBias), sizeof(nnNetwork.outBias));
+        ifs.read(reinterpret_cast<char*>(nnNetwork.outWeight), sizeof(nnNetwork.outWeight));
+        if(!ifs){
+            cerr << "loadNNUE() : truncated file " << path << endl;
+            return false;
+        }
+        nnLoaded = true;
+        return true;
+    }
+    
+    // 形式 : "DABPTRN1", int32 形の数, 各形の線の数, int16 weight[PT_TABLE_SIZE]
+    // 読み込み後に作った盤面から差分計算が有効になる
+    bool loadPatterns(const std::string& path){
+        ptLoaded = false;
+        std::ifstream ifs(path, std::ios::binary);
+        if(!ifs){
+            cerr << "loadPatterns() : failed to open " << path << endl;
+            return false;
+        }
+        char magic[8];
+        int32_t shapes, lines[PT_SHAPES];
+        ifs.read(magic, sizeof(magic));
+        ifs.read(reinterpret_cast<char*>(&shapes), sizeof(shapes));
+        bool ok = ifs && !memcmp(magic, "DABPTRN1", 8) && shapes == PT_SHAPES;
+        if(ok){
+            ifs.read(reinterpret_cast<char*>(lines), sizeof(lines));
+            for(int s = 0; s < PT_SHAPES; ++s){
+                ok = ok && lines[s] == ptLines(s);
+            }
+        }
+        if(!ok){
+            cerr << "loadPatterns() : unsupported file " << path << endl;
+            return false;
+        }
+        ifs.read(reinterpret_cast<char*>(ptWeight), sizeof(ptWeight));
+        if(!ifs){
+            cerr << "loadPatterns() : truncated file " << path << endl;
+            return false;
+        }
+        ptLoaded = true;
+        return true;
+    }
+    bool savePatterns(const std::string& path){
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        const int32_t shapes = PT_SHAPES;
+        int32_t lines[PT_SHAPES];
+        for(int s = 0; s < PT_SHAPES; ++s){
+            lines[s] = ptLines(s);
+        }
+        ofs.write("DABPTRN1", 8);
+        ofs.write(reinterpret_cast<const char*>(&shapes), sizeof(shapes));
+        ofs.write(reinterpret_cast<const char*>(lines), sizeof(lines));
+        ofs.write(reinterpret_cast<const char*>(ptWeight), sizeof(ptWeight));
+        if(!ofs){
+            cerr << "savePatterns() : failed to write " << path << endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+#endif // DAB_NNUE_HPP_
\ No newline at end of file
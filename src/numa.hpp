@@ -0,0 +1,164 @@
+/*
+ numa.hpp
+ Katsuki Ohto
+ */
+
+#ifndef DAB_NUMA_HPP_
+#define DAB_NUMA_HPP_
+
+#include <sched.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+
+#include "dab.hpp"
+
+namespace DotsAndBoxes{
+    
+    /**************************NUMA 構成**************************/
+    
+    // libnuma を使わず sysfs と生のシステムコールだけで扱う
+    // 取得できない環境では全 CPU が1つのノードにあるものとして動く
+    
+    // "0-3,8-11" の形式
+    std::vector<int> parseCPUList(const std::string& str){
+        std::vector<int> cpus;
+        std::istringstream iss(str);
+        std::string range;
+        while(std::getline(iss, range, ',')){
+            if(range.empty() || range[0] == '\n'){ continue; }
+            const size_t dash = range.find('-');
+            const int first = atoi(range.c_str());
+            const int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+            for(int c = first; c <= last; ++c){ cpus.push_back(c); }
+        }
+        return cpus;
+    }
+    
+    struct NumaTopology{
+        std::vector<int> nodeIds;
+        std::vector<std::vector<int>> cpus; // ノードごとの CPU
+        
+        NumaTopology(){ detect(); }
+        
+        int nodes()const noexcept{ return nodeIds.size(); }
+        int totalCPUs()const noexcept{
+            int n = 0;
+            for(const auto& c : cpus){ n += c.size(); }
+            return n;
+        }
+        
+        void detect(){
+            nodeIds.clear();
+            cpus.clear();
+            const std::string base = "/sys/devices/system/node/";
+            if(DIR *dir = opendir(base.c_str())){
+                while(dirent *ent = readdir(dir)){
+                    int id;
+                    if(sscanf(ent->d_name, "node%d", &id) != 1){ continue; }
+                    std::ifstream ifs(base + ent->d_name + "/cpulist");
+                    std::string list;
+                    std::getline(ifs, list);
+                    std::vector<int> c = parseCPUList(list);
+                    if(c.empty()){ continue; } // CPU の無いノード (メモリのみ)
+                    nodeIds.push_back(id);
+                    cpus.push_back(c);
+                }
+                closedir(dir);
+            }
+            // ノード番号順に並べる
+            std::vector<int> order(nodeIds.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [this](int a, int b){ return nodeIds[a] < nodeIds[b]; });
+            std::vector<int> ids;
+            std::vector<std::vector<int>> cs;
+            for(int i : order){ ids.push_back(nodeIds[i]); cs.push_back(cpus[i]); }
+            nodeIds.swap(ids);
+            cpus.swap(cs);
+            if(nodeIds.empty()){
+                std::vector<int> all((int)std::max(1L, sysconf(_SC_NPROCESSORS_ONLN)));
+                std::iota(all.begin(), all.end(), 0);
+                nodeIds.push_back(0);
+                cpus.push_back(all);
+            }
+        }
+        
+        std::string toString()const{
+            std::ostringstream oss;
+            oss << nodes() << " NUMA nodes, " << totalCPUs() << " CPUs";
+            for(int n = 0; n < nodes(); ++n){
+                oss << " [node " << nodeIds[n] << " :";
+                for(int c : cpus[n]){ oss << " " << c; }
+                oss << "]";
+            }
+            return oss.str();
+        }
+    };
+    
+    /**************************スレッドの固定**************************/
+    
+    enum PinPolicy{
+        PIN_NONE, // OS に任せる
+        PIN_COMPACT, // ノード 0 の CPU から順に埋める
+        PIN_SPREAD // ノードを順番に回る (メモリ帯域を分け合う)
+    };
+    
+    PinPolicy string2PinPolicy(const std::string& str){
+        if(str == "compact"){ return PIN_COMPACT; }
+        if(str == "spread"){ return PIN_SPREAD; }
+        if(str != "none"){ LOG_WARN("unknown pin policy " << str << ", using none"); }
+        return PIN_NONE;
+    }
+    
+    // index 番目のスレッドを置く CPU (-1 なら固定しない)
+    int cpuForThread(const NumaTopology& topo, PinPolicy policy, int index){
+        const int total = topo.totalCPUs();
+        if(policy == PIN_NONE || total <= 0){ return -1; }
+        if(policy == PIN_COMPACT){
+            int i = index % total;
+            for(const auto& c : topo.cpus){
+                if(i < (int)c.size()){ return c[i]; }
+                i -= c.size();
+            }
+            return -1;
+        }
+        // PIN_SPREAD
+        const int n = index % topo.nodes();
+        const auto& c = topo.cpus[n];
+        return c[(index / topo.nodes()) % c.size()];
+    }
+    
+    // 呼び出したスレッドを cpu に固定する
+    bool pinThisThread(int cpu){
+        if(cpu < 0){ return false; }
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(syscall(SYS_sched_setaffinity, 0, sizeof(set), &set) != 0){
+            LOG_WARN("pinThisThread() : failed to pin to cpu " << cpu);
+            return false;
+        }
+        return true;
+    }
+    
+    /**************************メモリの配置**************************/
+    
+    // <numaif.h> が無くても使えるように定数は自前で持つ
+    constexpr int NUMA_MPOL_INTERLEAVE = 3;
+    
+    // [addr, addr + bytes) のページを全ノードに順に割り当てる
+    // まだ触れていないページに対して呼べば、以降の確保がこの方針に従う
+    bool interleaveMemory(void *addr, size_t bytes, const NumaTopology& topo){
+        if(topo.nodes() <= 1){ return false; } // 分ける先が無い
+        unsigned long mask[16] = {0}; // 1024 ノードまで
+        for(int id : topo.nodeIds){
+            if(id < 1024){ mask[id / 64] |= 1UL << (id % 64); }
+        }
+        if(syscall(SYS_mbind, addr, bytes, NUMA_MPOL_INTERLEAVE, mask, 1024 + 1, 0) != 0){
+            LOG_WARN("interleaveMemory() : mbind failed (errno " << errno << ")");
+            return false;
+        }
+        return true;
+    }
+}
+
+#endif // DAB_NUMA_HPP_
\ No newline at end of file
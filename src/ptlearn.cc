@@ -0,0 +1,111 @@
+/*
+ ptlearn.cc
+ Katsuki Ohto
+ */
+
+// 自己対戦の記録 (datagen の出力) からパターン評価の重みを学習する
+// 例 : ptlearn -I data -O pattern.bin -E 8 -L 0.0002
+// 目標は各局面から終局までに付いた陣地差 (手番側から見た残りのマスの得点差)
+// 記録の一部 (線の集合のハッシュで決める) は学習に使わず検証に回す
+
+#include "dab.hpp"
+#include "nnue.hpp"
+#include "datagen.hpp"
+
+using namespace DotsAndBoxes;
+
+// lineSetIndex の逆 : 線の集合の番号 -> (vh ごとの) 線のビット集合
+struct LineSetDecoder{
+    Move lineMove[64];
+    
+    LineSetDecoder(){
+        MiniBoard mbd;
+        mbd.clear();
+        Move buffer[MAX_MOVES];
+        const int moves = genAllMoves(buffer, mbd);
+        for(int m = 0; m < moves; ++m){
+            lineMove[lineIndex(buffer[m])] = buffer[m];
+        }
+    }
+    void decode(uint64_t index, uint64_t *const lineSet)const noexcept{
+        lineSet[V] = lineSet[H] = 0;
+        for(; index; index &= index - 1){
+            const Move move = lineMove[bsf64(index)];
+            lineSet[move.vh] |= 1ULL << move.mz;
+        }
+    }
+};
+
+bool isValidation(const TrainingRecord& record)noexcept{
+    return ((record.lines * 0x9E3779B97F4A7C15ULL) >> 60) == 0; // 1/16
+}
+
+int learn(const std::string& dir, const std::string& path, int epochs, double rate){
+    const LineSetDecoder decoder;
+    std::vector<double> weight(PT_TABLE_SIZE, 0.0);
+    std::vector<int> indices(ptInstances.size());
+    
+    for(int e = 0; e < epochs; ++e){
+        ShardReader reader(dir, 1 << 20, dice());
+        TrainingRecord record;
+        int64_t n[2] = {0}; // 学習、検証
+        double loss[2] = {0}, baseLoss[2] = {0};
+        ClockMicS clock;
+        clock.start();
+        while(reader.next(&record)){
+            uint64_t lineSet[2];
+            decoder.decode(record.lines, lineSet);
+            double predicted = 0;
+            for(int i = 0; i < (int)ptInstances.size(); ++i){
+                indices[i] = patternIndex(ptInstances[i], lineSet);
+                predicted += weight[indices[i]];
+            }
+            const double target = record.result - record.areaDiff;
+            const double error = predicted - target;
+            const int v = isValidation(record);
+            n[v] += 1;
+            loss[v] += error * error;
+            baseLoss[v] += target * target;
+            if(!v){ // 二乗誤差の勾配で各領域の重みを動かす
+                for(int index : indices){
+                    weight[index] -= rate * error;
+                }
+            }
+        }
+        if(n[0] + n[1] == 0){
+            cerr << "learn() : no records in " << dir << endl;
+            return -1;
+        }
+        for(int v = 0; v < 2; ++v){
+            cerr << "epoch " << e << (v ? " validation" : " train") << " records " << n[v];
+            cerr << " mse " << (n[v] ? loss[v] / n[v] : 0.0);
+            cerr << " (zero " << (n[v] ? baseLoss[v] / n[v] : 0.0) << ")" << endl;
+        }
+        cerr << "time " << clock.stop() / 1000 << " ms" << endl;
+    }
+    for(int i = 0; i < PT_TABLE_SIZE; ++i){
+        const double w = std::round(weight[i] * PT_SCALE);
+        ptWeight[i] = int16_t(std::max(-32767.0, std::min(32767.0, w)));
+    }
+    return savePatterns(path) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]){
+    std::string dir = "data";
+    std::string path = "pattern.bin";
+    int epochs = 8;
+    double rate = 0.0002;
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-I")){ // 学習データ (datagen の出力先)
+            dir = std::string(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-O")){
+            path = std::string(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-E")){ // 全データを何周するか
+            epochs = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-L")){ // 学習率
+            rate = atof(argv[c + 1]);
+        }
+    }
+    cerr << ptInstances.size() << " pattern instances, " << PT_TABLE_SIZE << " weights" << endl;
+    return learn(dir, path, epochs, rate);
+}
\ No newline at end of file
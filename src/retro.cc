@@ -0,0 +1,36 @@
+/*
+ retro.cc
+ Katsuki Ohto
+ */
+
+// 小さい盤面の全局面を後退解析して解の表を作る
+// 例 : retro -X 3 -Y 3 -O solution33.bin
+
+#include "dab.hpp"
+#include "retrograde.hpp"
+
+using namespace DotsAndBoxes;
+
+int main(int argc, char *argv[]){
+    int lx = 3, ly = 3;
+    std::string path = "solution.bin";
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-X")){
+            lx = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-Y")){
+            ly = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-O")){
+            path = std::string(argv[c + 1]);
+        }
+    }
+    if(!solveRetrograde(lx, ly, path)){
+        return -1;
+    }
+    // 初期局面の値を確認
+    SolutionTable table;
+    if(!table.open(path)){
+        return -1;
+    }
+    cerr << lx << "x" << ly << " initial value " << table.get(0) << endl;
+    return 0;
+}
\ No newline at end of file
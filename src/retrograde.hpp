@@ -0,0 +1,291 @@
+/*
+ retrograde.hpp
+ Katsuki Ohto
+ */
+
+#ifndef DAB_RETROGRADE_HPP_
+#define DAB_RETROGRADE_HPP_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dab.hpp"
+
+namespace DotsAndBoxes{
+    
+    /**************************線の番号付け**************************/
+    
+    // 線の集合を 0 ~ 2^lines - 1 の整数として扱う (完全ハッシュ)
+    // 番号は genAllMoves の生成順と同じく縦線、横線の順
+    struct LineGeometry{
+        // 表を作れる大きさの上限
+        // 3x3 (24 本) までを対象とする確定した値で、4x4 (40 本) は 2^40 局面の表を持てないので扱わない
+        static constexpr int MAX_LINES = 32;
+        int lx, ly;
+        int vlines, lines, boxes;
+        std::vector<uint64_t> boxMask; // マス -> 周囲4本の線
+        std::vector<std::array<int, 2>> lineBox; // 線 -> 接するマス (無ければ -1)
+        
+        int vIndex(int bx, int y)const noexcept{ return bx * (ly + 1) + y; }
+        int hIndex(int x, int by)const noexcept{ return vlines + x * ly + by; }
+        uint64_t full()const noexcept{ return (1ULL << lines) - 1; }
+        
+        LineGeometry(int alx, int aly):
+        lx(alx), ly(aly){
+            vlines = lx * (ly + 1);
+            lines = vlines + (lx + 1) * ly;
+            boxes = lx * ly;
+            boxMask.assign(boxes, 0);
+            lineBox.assign(lines, {-1, -1});
+            for(int bx = 0; bx < lx; ++bx){
+                for(int by = 0; by < ly; ++by){
+                    const int b = bx * ly + by;
+                    const int l[4] = {vIndex(bx, by), vIndex(bx, by + 1),
+                                      hIndex(bx, by), hIndex(bx + 1, by)};
+                    for(int i = 0; i < 4; ++i){
+                        boxMask[b] |= 1ULL << l[i];
+                        lineBox[l[i]][lineBox[l[i]][0] < 0 ? 0 : 1] = b;
+                    }
+                }
+            }
+        }
+        // 線の集合 lines に線 l を引いた時に取れるマス数
+        int captured(uint64_t set, int l)const noexcept{
+            const uint64_t nset = set | (1ULL << l);
+            int cnt = 0;
+            for(int b : lineBox[l]){
+                if(b >= 0 && (nset & boxMask[b]) == boxMask[b]){ cnt += 1; }
+            }
+            return cnt;
+        }
+    };
+    
+    // この盤面設定での着手 -> 線番号
+    int lineIndex(Move move)noexcept{
+        const int x = z2x(move.mz), y = z2y(move.mz);
+        if(move.vh == V){
+            return (x - 1) * (LENGTH_Y + 1) + y;
+        }else{
+            return VLINES + x * LENGTH_Y + (y - 1);
+        }
+    }
+    
+    template<class board_t>
+    uint64_t lineSetIndex(const board_t& bd){
+        uint64_t index = 0;
+        for(int x = 1; x < LX - 1; ++x){
+            for(int y = 0; y < LY - 1; ++y){
+                int z = xy2z(x, y);
+                if(bd.line(z, DIR_3)){ index |= 1ULL << lineIndex(Move(V, z)); }
+            }
+        }
+        for(int x = 0; x < LX - 1; ++x){
+            for(int y = 1; y < LY - 1; ++y){
+                int z = xy2z(x, y);
+                if(bd.line(z, DIR_2)){ index |= 1ULL << lineIndex(Move(H, z)); }
+            }
+        }
+        return index;
+    }
+    
+    /**************************解の表**************************/
+    
+    // 各局面の値 (手番側から見た残りのマスの得点差) をビット詰めで持つ
+    // 1語 (64bit) をまたがないように詰める
+    struct SolutionHeader{
+        char magic[8];
+        int32_t lx, ly;
+        int32_t bits, perWord;
+        uint64_t words;
+    };
+    constexpr char SOLUTION_MAGIC[8] = {'D', 'A', 'B', 'S', 'O', 'L', 'V', '1'};
+    
+    struct SolutionTable{
+        SolutionHeader header_;
+        uint64_t *words_;
+        int offset_; // 値の下駄
+        void *map_;
+        size_t mapSize_;
+        
+        static int bitsFor(int boxes)noexcept{
+            int bits = 1;
+            while((1 << bits) < 2 * boxes + 1){ ++bits; }
+            return bits;
+        }
+        static size_t fileSize(const SolutionHeader& header)noexcept{
+            return sizeof(SolutionHeader) + header.words * sizeof(uint64_t);
+        }
+        
+        SolutionTable():
+        words_(nullptr), map_(MAP_FAILED), mapSize_(0){}
+        ~SolutionTable(){ close(); }
+        
+        bool matches(int lx, int ly)const noexcept{
+            return words_ != nullptr && header_.lx == lx && header_.ly == ly;
+        }
+        int get(uint64_t index)const noexcept{
+            const uint64_t w = words_[index / header_.perWord];
+            const int shift = (index % header_.perWord) * header_.bits;
+            return int((w >> shift) & ((1ULL << header_.bits) - 1)) - offset_;
+        }
+        
+        // ヘッダの値が盤の大きさから決まる値と一致するか
+        static bool validHeader(const SolutionHeader& header)noexcept{
+            if(memcmp(header.magic, SOLUTION_MAGIC, sizeof(SOLUTION_MAGIC))){ return false; }
+            if(header.lx <= 0 || header.ly <= 0
+               || header.lx > LineGeometry::MAX_LINES || header.ly > LineGeometry::MAX_LINES){ return false; }
+            const int lines = header.lx * (header.ly + 1) + (header.lx + 1) * header.ly;
+            if(lines > LineGeometry::MAX_LINES){ return false; }
+            const int bits = bitsFor(header.lx * header.ly);
+            const int perWord = 64 / bits;
+            return header.bits == bits && header.perWord == perWord
+            && header.words == ((1ULL << lines) + perWord - 1) / perWord;
+        }
+        
+        // 読み込み専用でメモリに割り当てる
+        bool open(const std::string& path){
+            close();
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0){
+                cerr << "SolutionTable::open() : failed to open " << path << endl;
+                return false;
+            }
+            struct stat st;
+            if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(SolutionHeader)){
+                ::close(fd);
+                return false;
+            }
+            mapSize_ = st.st_size;
+            map_ = mmap(nullptr, mapSize_, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if(map_ == MAP_FAILED){
+                cerr << "SolutionTable::open() : failed to map " << path << endl;
+                return false;
+            }
+            memcpy(&header_, map_, sizeof(SolutionHeader));
+            if(!validHeader(header_) || fileSize(header_) != mapSize_){
+                cerr << "SolutionTable::open() : broken file " << path << endl;
+                close();
+                return false;
+            }
+            words_ = reinterpret_cast<uint64_t*>(static_cast<char*>(map_) + sizeof(SolutionHeader));
+            offset_ = header_.lx * header_.ly;
+            return true;
+        }
+        void close(){
+            if(map_ != MAP_FAILED){
+                munmap(map_, mapSize_);
+            }
+            map_ = MAP_FAILED;
+            words_ = nullptr;
+        }
+    };
+    
+    // 表を引いて最善手を返す (盤の大きさが一致している場合のみ)
+    template<class board_t, class rootMoves_t>
+    std::tuple<Move, Value> solvedMove(const SolutionTable& table, const board_t& obd,
+                                       rootMoves_t& rootMoves){
+        board_t bd = obd;
+        const uint64_t index = lineSetIndex(bd);
+        const Color turnColor = bd.turnColor();
+        Move bestMove = MOVE_NONE;
+        Value bestValue = -VALUE_INFINITE;
+        for(auto& rm : rootMoves){
+            const uint64_t child = index | (1ULL << lineIndex(rm.move));
+            int newArea = bd.move(rm.move);
+            int value = newArea ? (newArea + table.get(child)) : -table.get(child);
+            bd.unmove(rm.move);
+            rm.value = Value(value + bd.areaDiff(turnColor));
+            if(rm.value > bestValue){
+                bestValue = rm.value;
+                bestMove = rm.move;
+            }
+        }
+        return std::make_tuple(bestMove, bestValue);
+    }
+    
+    /**************************後退解析**************************/
+    
+    // 全ての線を引いた局面から線の数の層ごとに遡って解く
+    // 同じ層の局面は互いに依存しないので層内を並列に計算する
+    // 各層の局面は線の組合せとして直接列挙し、他の層の番号は見ない
+    bool solveRetrograde(int lx, int ly, const std::string& path){
+        const LineGeometry geo(lx, ly);
+        if(geo.lines > LineGeometry::MAX_LINES){
+            cerr << "solveRetrograde() : too many lines " << geo.lines << endl;
+            return false;
+        }
+        SolutionHeader header;
+        memcpy(header.magic, SOLUTION_MAGIC, sizeof(SOLUTION_MAGIC));
+        header.lx = lx; header.ly = ly;
+        header.bits = SolutionTable::bitsFor(geo.boxes);
+        header.perWord = 64 / header.bits;
+        header.words = ((1ULL << geo.lines) + header.perWord - 1) / header.perWord;
+        const size_t size = SolutionTable::fileSize(header);
+        
+        // 出力ファイルをそのままメモリに割り当てて書き込む
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0 || ftruncate(fd, size) < 0){
+            cerr << "solveRetrograde() : failed to create " << path << endl;
+            if(fd >= 0){ ::close(fd); }
+            return false;
+        }
+        void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(map == MAP_FAILED){
+            cerr << "solveRetrograde() : failed to map " << path << endl;
+            return false;
+        }
+        memcpy(map, &header, sizeof(SolutionHeader));
+        uint64_t *const words = reinterpret_cast<uint64_t*>(static_cast<char*>(map) + sizeof(SolutionHeader));
+        
+        const int bits = header.bits, perWord = header.perWord;
+        const int offset = geo.boxes;
+        const uint64_t full = geo.full();
+        auto get = [&](uint64_t index)->int{
+            const uint64_t w = __atomic_load_n(&words[index / perWord], __ATOMIC_RELAXED);
+            return int((w >> ((index % perWord) * bits)) & ((1ULL << bits) - 1)) - offset;
+        };
+        
+        ClockMicS clock;
+        clock.start();
+        // 上位の線の組ごとに仕事を分け、残りの線から足りない本数を選ぶ組合せを順に作る
+        const int highLines = std::min(geo.lines, 10);
+        const int lowLines = geo.lines - highLines;
+        for(int layer = geo.lines; layer >= 0; --layer){
+#pragma omp parallel for schedule(dynamic, 1)
+            for(int64_t high = 0; high < (int64_t(1) << highLines); ++high){
+                const int r = layer - countBits64(high);
+                if(r < 0 || r > lowLines){ continue; }
+                uint64_t low = (1ULL << r) - 1;
+                while(true){
+                    const uint64_t index = (uint64_t(high) << lowLines) | low;
+                    int best = (layer == geo.lines) ? 0 : -geo.boxes;
+                    for(uint64_t rest = ~index & full; rest; rest &= rest - 1){
+                        const int l = bsf64(rest);
+                        const uint64_t child = index | (1ULL << l);
+                        const int c = geo.captured(index, l);
+                        best = std::max(best, c ? (c + get(child)) : -get(child));
+                    }
+                    // 同じ語を他のスレッドも書くので自分の場所だけを立てる
+                    const uint64_t value = uint64_t(best + offset) << ((index % perWord) * bits);
+                    if(value){
+                        __atomic_fetch_or(&words[index / perWord], value, __ATOMIC_RELAXED);
+                    }
+                    if(r == 0){ break; }
+                    // r 本を選ぶ次の組合せ
+                    const uint64_t t = low | (low - 1);
+                    low = (t + 1) | (((~t & (t + 1)) - 1) >> (bsf64(low) + 1));
+                    if(low >> lowLines){ break; }
+                }
+            }
+            cerr << "layer " << layer << " time " << clock.stop() / 1000 << endl;
+        }
+        msync(map, size, MS_SYNC);
+        munmap(map, size);
+        return true;
+    }
+}
+
+#endif // DAB_RETROGRADE_HPP_
\ No newline at end of file
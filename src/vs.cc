@@ -5,71 +5,153 @@
 
 #include "dab.hpp"
 #include "agent.hpp"
+#include "dfpn.hpp"
 
 using namespace DotsAndBoxes;
 
-int battle(Color myColor, std::vector<Move> orecord){
-    SearchAgent *const pa = new SearchAgent(15000);
-    MiniBoard mbd;
-    mbd.clear();
-    std::vector<Move> record = orecord;
+// 記録の手を順に進める (非合法手があればそこで止めて false)
+bool replay(GameSession *const psession, const std::vector<Move>& record){
     for(auto move : record){
-        cerr << mbd;
-        mbd.move(move);
-    }
-    while(!mbd.filled()){
-        mbd.clear();
-        for(auto move : record){
-            mbd.move(move);
+        if(!psession->legal(move)){
+            cerr << "illegal move " << move << " in record at ply " << psession->board.ply << endl;
+            return false;
         }
-        
-        cerr << mbd << endl;
+        psession->apply(move);
+    }
+    return true;
+}
+
+int battle(Color myColor, const std::vector<Move>& record, int multiPV, bool selective,
+           std::ostream *statsStream, const SolutionTable *solution, DfpnSolver *dfpn,
+           Cluster *cluster){
+    SearchAgent *const pa = new SearchAgent(15000);
+    pa->setMultiPV(multiPV);
+    pa->setSelective(selective);
+    pa->setSolution(solution);
+    pa->setCluster(cluster);
+    ANALYZE(pa->statsStream = statsStream);
+    GameSession session;
+    if(!replay(&session, record)){ return -1; }
+    const Board& bd = session.board;
+    while(!bd.filled()){
+        // 対局者に見せるものなのでログの水準に関係なく出す
+        cerr << MiniBoard(bd) << endl;
         cerr << "record ";
-        for(auto mv : record){ cerr << mv << " "; }
+        for(auto mv : session.history){ cerr << mv << " "; }
         cerr << endl;
         
         Move move;
-        if(mbd.turnColor() == myColor){
-            auto moveValue = pa->searchMove(mbd, 100);
+        if(bd.turnColor() == myColor){
+            // 探索と並行して勝ちを証明する
+            if(dfpn != nullptr){ dfpn->start(bd, 1); }
+            auto moveValue = pa->searchMove(bd, 100);
             move = std::get<0>(moveValue);
-            mbd.move(move);
+            if(dfpn != nullptr){
+                dfpn->stop();
+                if(dfpn->result() == 1 && dfpn->move() != MOVE_NONE && std::get<1>(moveValue) < 1){
+                    LOG_INFO("dfpn proved win by " << dfpn->move() << " nodes " << dfpn->nodes());
+                    move = dfpn->move();
+                }
+            }
         }else{
             std::string str;
-            std::cin >> str;
-            if(str == "back"){
-                int lastOpp = 0;
-                mbd.clear();
-                for(auto move : record){
-                    if(mbd.turnColor() == ~myColor){ lastOpp = max(lastOpp, mbd.ply); }
-                    mbd.move(move);
-                }
-                for(int m = record.size() - 1; m >= lastOpp; --m){
-                    record.pop_back();
-                }
+            if(!(std::cin >> str)){ break; }
+            if(str == "back"){ // 相手の直前の手の前まで戻す
+                session.undoTurn(~myColor);
+                continue;
+            }
+            if(str.size() < 3){
+                LOG_WARN("illegal move " << str);
                 continue;
             }
             move = string2move(str);
-            mbd.move(move);
+            if(!session.legal(move)){
+                LOG_WARN("illegal move " << str);
+                continue;
+            }
         }
-        record.push_back(move);
+        session.apply(move);
     }
     return 0;
 }
 
+// 記録の局面の勝敗を読み切って終了
+int solve(const std::vector<Move>& record, DfpnSolver *dfpn){
+    GameSession session;
+    if(!replay(&session, record)){ return -1; }
+    const Board& bd = session.board;
+    cerr << MiniBoard(bd);
+    Move move = MOVE_NONE;
+    SolveResult result;
+    if(dfpn != nullptr){
+        const int win = dfpn->prove(bd, 1, &move);
+        if(win != 0){
+            result = win > 0 ? SOLVE_WIN : SOLVE_UNKNOWN;
+        }else if(SIZE % 2 == 1){
+            result = SOLVE_LOSS;
+        }else{
+            const int draw = dfpn->prove(bd, 0, &move);
+            result = draw < 0 ? SOLVE_UNKNOWN : (draw > 0 ? SOLVE_DRAW : SOLVE_LOSS);
+        }
+        LOG_INFO("dfpn nodes " << dfpn->nodes());
+    }else{
+        SearchAgent *const pa = new SearchAgent(1000000);
+        result = pa->solve(bd, &move);
+    }
+    // 結果はログの水準に関係なく標準出力に出す
+    cout << "solve : " << result;
+    if(result == SOLVE_WIN || result == SOLVE_DRAW){
+        cout << " by " << move;
+    }
+    cout << endl;
+    return 0;
+}
+
 int main(int argc, char *argv[]){
     std::vector<Move> record;
+    int multiPV = 1;
+    bool selective = false;
+    std::ofstream statsFile;
+    SolutionTable solution;
+    bool solveMode = false;
+    size_t dfpnMB = 0;
+    Cluster cluster;
     for(int c = 1; c < argc; ++c){
-        if(!strcmp(argv[c], "-R")){
-            for(int cc = c + 1; cc < argc; ++cc){
-                if(!strcmp(argv[c], "-F")){
-                    break;
-                }
+        if(!strcmp(argv[c], "-M")){ // 上位何手の評価値を出すか
+            multiPV = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-L")){ // 選択的探索 (LMR 等) を使う
+            selective = true;
+        }else if(!strcmp(argv[c], "-S")){ // 探索統計の出力先
+            statsFile.open(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-D")){ // 後退解析の結果
+            solution.open(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-N")){ // 評価関数の重み
+            loadNNUE(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-E")){ // パターン評価の重み (ptlearn の出力)
+            loadPatterns(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-W")){ // 勝敗の読み切りのみ
+            solveMode = true;
+        }else if(!strcmp(argv[c], "-P")){ // 証明数探索の置換表の大きさ (MB)
+            dfpnMB = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-C")){ // 分散探索のワーカー (host:port,...)
+            cluster.connect(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-R")){ // 棋譜 (次のオプションまで)
+            int cc = c + 1;
+            for(; cc < argc && argv[cc][0] != '-'; ++cc){
                 std::string str = std::string(argv[cc]);
-                Move move = string2move(str);
-                record.push_back(move);
+                if(str.size() < 3){
+                    cerr << "illegal move " << str << " in record" << endl;
+                    return -1;
+                }
+                record.push_back(string2move(str));
             }
+            c = cc - 1;
         }
     }
-    battle(W, record);
-    return 0;
+    DfpnSolver *const dfpn = dfpnMB > 0 ? new DfpnSolver(dfpnMB << 20) : nullptr;
+    if(solveMode){
+        return solve(record, dfpn);
+    }
+    return battle(W, record, multiPV, selective, statsFile.is_open() ? &statsFile : nullptr, &solution, dfpn,
+                  cluster.alive() > 0 ? &cluster : nullptr);
 }
\ No newline at end of file
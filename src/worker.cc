@@ -0,0 +1,106 @@
+/*
+ worker.cc
+ Katsuki Ohto
+ */
+
+// 分散探索のワーカー
+// 親 (vs -C) から root move を1つずつ受け取り、自分の置換表で探索して値を返す
+// 例 (同じ計算機で試す場合) :
+//   worker -P 20001 &
+//   worker -P 20002 &
+//   vs -C localhost:20001,localhost:20002
+
+#include "dab.hpp"
+#include "agent.hpp"
+#include "cluster.hpp"
+
+using namespace DotsAndBoxes;
+
+// 局面で root move を指した後を探索し、元の手番側から見た値を返す
+std::string searchUnit(SearchAgent *const pa, std::istream& is){
+    int id, depth;
+    int64_t timeMs;
+    std::string moveString;
+    MiniBoard mbd;
+    is >> id >> depth >> timeMs >> moveString;
+    if(!is || !decodePosition(is, &mbd)){ return ""; }
+    const Move move = string2move(moveString);
+    if(!((mbd.undrawnLines(move.vh) >> move.mz) & 1)){ return ""; }
+    const Color turnColor = mbd.turnColor();
+    mbd.move(move);
+    
+    int value, searchDepth = 0;
+    int64_t nodes = 0;
+    if(mbd.filled()){
+        value = mbd.area[turnColor] - mbd.area[~turnColor];
+    }else{
+        pa->timeLimit = timeMs * 1000;
+        auto moveValue = pa->searchMove(mbd, depth);
+        value = std::get<1>(moveValue);
+        // 最初の反復も終わらなければ値は無い (親には最悪の値として返す)
+        if(value <= -VALUE_INFINITE){
+            value = -VALUE_INFINITE;
+        }else if(mbd.turnColor() != turnColor){
+            value = -value;
+        }
+        nodes = pa->nodes;
+        searchDepth = pa->rootMoves[0].searchDepth;
+    }
+    std::ostringstream oss;
+    oss << "result " << id << " " << value << " " << nodes << " " << searchDepth;
+    return oss.str();
+}
+
+// 親と切れたら次の接続を待つ
+int serve(int port){
+    const int listenFd = listenSocket(port);
+    if(listenFd < 0){
+        LOG_ERROR("worker : failed to listen on " << port);
+        return 1;
+    }
+    SearchAgent *const pa = new SearchAgent(1000);
+    pa->verbose = false;
+    LOG_INFO("worker : listening on " << port);
+    while(true){
+        const int fd = accept(listenFd, nullptr, nullptr);
+        if(fd < 0){ continue; }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        MessageSocket socket(fd);
+        LOG_INFO("worker : connected");
+        std::string line;
+        while(socket.receiveLine(&line)){
+            std::istringstream iss(line);
+            std::string command;
+            iss >> command;
+            if(command == "quit"){ break; }
+            if(command != "unit"){
+                LOG_WARN("worker : unknown command " << line);
+                continue;
+            }
+            const std::string result = searchUnit(pa, iss);
+            if(result.empty()){
+                LOG_WARN("worker : invalid unit " << line);
+                break;
+            }
+            if(!socket.send(result)){ break; }
+        }
+        socket.close();
+        LOG_INFO("worker : disconnected");
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]){
+    int port = 20001;
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-P")){ // 待ち受けるポート
+            port = atoi(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-N")){ // 評価関数の重み
+            loadNNUE(argv[c + 1]);
+        }else if(!strcmp(argv[c], "-E")){ // パターン評価の重み (ptlearn の出力)
+            loadPatterns(argv[c + 1]);
+        }
+    }
+    return serve(port);
+}
\ No newline at end of file